@@ -0,0 +1,88 @@
+/*
+ * arena.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.hpp"
+#include "realtimememory.hpp"
+#include "exceptions.hpp"
+
+namespace dyplo
+{
+	const size_t Arena::cache_line_size;
+
+	static const size_t huge_page_size = 2 * 1024 * 1024;
+
+	static size_t round_up(size_t value, size_t multiple)
+	{
+		return ((value + multiple - 1) / multiple) * multiple;
+	}
+
+	Arena::Arena(size_t size, bool huge_pages):
+		m_memory(NULL),
+		m_size(0),
+		m_used(0),
+		m_huge_pages(false)
+	{
+		void* memory = MAP_FAILED;
+		if (huge_pages)
+		{
+			m_size = round_up(size, huge_page_size);
+			memory = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			m_huge_pages = (memory != MAP_FAILED);
+		}
+		if (memory == MAP_FAILED)
+		{
+			m_size = round_up(size, ::sysconf(_SC_PAGESIZE));
+			memory = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED)
+				throw IOException("mmap");
+			if (huge_pages)
+				::madvise(memory, m_size, MADV_HUGEPAGE); /* Just a hint */
+		}
+		m_memory = static_cast<char*>(memory);
+		RealtimeMemory::prepare(m_memory, m_size);
+	}
+
+	Arena::~Arena()
+	{
+		::munmap(m_memory, m_size);
+	}
+
+	void* Arena::allocate(size_t size, size_t alignment)
+	{
+		/* The region itself is page aligned */
+		const size_t offset = round_up(m_used, alignment);
+		if ((offset > m_size) || (size > m_size - offset))
+			throw std::bad_alloc();
+		m_used = offset + size;
+		return m_memory + offset;
+	}
+}
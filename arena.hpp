@@ -0,0 +1,113 @@
+/*
+ * arena.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <new>
+#include <stddef.h>
+
+namespace dyplo
+{
+	/* One contiguous region from which a pipeline's queue buffers and
+	 * processes are allocated, so they sit close together and the
+	 * memory a pipeline uses is known up front. Allocations are never
+	 * returned individually, all memory is released when the arena is
+	 * destroyed, so the arena must outlive everything allocated from
+	 * it. Not thread safe, set up the pipeline from a single thread.
+	 * With "huge_pages" set, the region is backed by huge pages when
+	 * the system has them reserved, and otherwise asks for transparent
+	 * huge pages. */
+	class Arena
+	{
+	public:
+		static const size_t cache_line_size = 64;
+
+		Arena(size_t size, bool huge_pages = false);
+		~Arena();
+
+		/* Throws std::bad_alloc when the arena is exhausted */
+		void* allocate(size_t size, size_t alignment = cache_line_size);
+
+		/* Array of default-constructed elements, release with
+		 * destroy_array */
+		template <class T> T* allocate_array(unsigned int count)
+		{
+			T* result = static_cast<T*>(allocate(count * sizeof(T)));
+			unsigned int i = 0;
+			try
+			{
+				for (; i < count; ++i)
+					new (result + i) T();
+			}
+			catch (...)
+			{
+				destroy_array(result, i);
+				throw;
+			}
+			return result;
+		}
+
+		template <class T> static void destroy_array(T* data, unsigned int count)
+		{
+			for (unsigned int i = count; i != 0; --i)
+				data[i - 1].~T();
+		}
+
+		/* Counterpart of "new (arena) T(...)" */
+		template <class T> static void destroy(T* object)
+		{
+			if (object)
+				object->~T();
+		}
+
+		size_t size() const { return m_size; }
+		size_t used() const { return m_used; }
+		size_t available() const { return m_size - m_used; }
+		bool huge_pages() const { return m_huge_pages; }
+	protected:
+		char* m_memory;
+		size_t m_size;
+		size_t m_used;
+		bool m_huge_pages;
+	private:
+		Arena(const Arena&);
+		Arena& operator=(const Arena&);
+	};
+}
+
+/* Construct objects, for example processes, in an arena with
+ * "new (arena) T(...)" and destroy them with Arena::destroy. */
+inline void* operator new(size_t size, dyplo::Arena& arena)
+{
+	return arena.allocate(size);
+}
+
+/* Only called when a constructor throws, the memory stays in the arena */
+inline void operator delete(void*, dyplo::Arena&)
+{
+}
@@ -0,0 +1,254 @@
+/*
+ * broadcastqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "generics.hpp"
+#include "scopedlock.hpp"
+#include "exceptions.hpp"
+#include "realtimememory.hpp"
+
+namespace dyplo
+{
+	/* Queue with one writer and several readers that each see every
+	 * element. The readers share the buffer and each have their own
+	 * position, so nothing is copied. The writer waits for the slowest
+	 * reader. Readers are fixed at construction, pass reader(i) to a
+	 * process as its input queue.
+	 * The capacity is rounded up to a power of two, so that the buffer
+	 * index stays continuous when the positions wrap around.
+	 * All readers sleep on the same scheduler, so use the
+	 * PthreadScheduler (or NoopScheduler without waiting). */
+	template <class T, class Scheduler> class BroadcastQueue
+	{
+	public:
+		typedef T Element;
+
+		class Reader
+		{
+		public:
+			typedef T Element;
+
+			Reader(BroadcastQueue* queue):
+				m_queue(queue),
+				m_position(0),
+				m_interrupted(false)
+			{
+			}
+
+			/* Return pointer to the oldest element this reader has
+			 * not seen yet. Blocks until count_min are available. */
+			unsigned int begin_read(T* &buffer, unsigned int count_min)
+			{
+				return m_queue->begin_read(*this, buffer, count_min);
+			}
+			void end_read(unsigned int count)
+			{
+				m_queue->end_read(*this, count);
+			}
+
+			T pop_one()
+			{
+				T* buffer;
+				begin_read(buffer, 1);
+				T result = *buffer;
+				end_read(1);
+				return result;
+			}
+
+			unsigned int size() const { return m_queue->m_position - m_position; }
+			bool empty() const { return size() == 0; }
+
+			/* Affects this reader only */
+			void interrupt_read()
+			{
+				ScopedLock<Scheduler> lock(m_queue->m_scheduler);
+				m_interrupted = true;
+				m_queue->wake_readers();
+			}
+			void resume_read()
+			{
+				ScopedLock<Scheduler> lock(m_queue->m_scheduler);
+				m_interrupted = false;
+			}
+
+			Scheduler& get_scheduler() { return m_queue->m_scheduler; }
+		private:
+			friend class BroadcastQueue;
+			BroadcastQueue* m_queue;
+			unsigned int m_position;
+			bool m_interrupted;
+		};
+
+		BroadcastQueue(unsigned int capacity, unsigned int readers):
+			m_mask(round_up(capacity) - 1),
+			m_buff(new T[m_mask + 1]),
+			m_position(0),
+			m_waiting_readers(0)
+		{
+			RealtimeMemory::prepare(m_buff, (m_mask + 1) * sizeof(T));
+			m_readers.reserve(readers);
+			for (unsigned int i = 0; i < readers; ++i)
+				m_readers.push_back(Reader(this));
+		}
+
+		~BroadcastQueue()
+		{
+			delete [] m_buff;
+		}
+
+		Reader& reader(unsigned int index) { return m_readers[index]; }
+		unsigned int readers() const { return m_readers.size(); }
+
+		/* Return pointer to memory of "count" elements. Will block
+		 * until the slowest reader has made room for count_min. */
+		unsigned int begin_write(T* &buffer, unsigned int count_min)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			while (available() < count_min)
+				m_scheduler.wait_until_not_full();
+			const unsigned int index = m_position & m_mask;
+			buffer = m_buff + index;
+			return std::min(available(), capacity() - index);
+		}
+
+		void end_write(unsigned int count)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			DEBUG_ASSERT(count <= available(), "invalid end_write");
+			m_position += count;
+			wake_readers();
+		}
+
+		void push_one(const T data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = data;
+			end_write(1);
+		}
+
+		unsigned int capacity() const { return m_mask + 1; }
+		/* Room left for the writer */
+		unsigned int available() const { return capacity() - (m_position - slowest()); }
+
+		void interrupt_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.interrupt_not_full();
+		}
+		void resume_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.resume_not_full();
+		}
+
+		Scheduler& get_scheduler() { return m_scheduler; }
+		const Scheduler& get_scheduler() const { return m_scheduler; }
+	protected:
+		unsigned int begin_read(Reader& reader, T* &buffer, unsigned int count_min)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			while (reader.size() < count_min)
+			{
+				if (reader.m_interrupted)
+					throw InterruptedException();
+				++m_waiting_readers;
+				try
+				{
+					m_scheduler.wait_until_not_empty();
+				}
+				catch (...)
+				{
+					--m_waiting_readers;
+					throw;
+				}
+				--m_waiting_readers;
+			}
+			const unsigned int index = reader.m_position & m_mask;
+			buffer = m_buff + index;
+			return std::min(reader.size(), capacity() - index);
+		}
+
+		void end_read(Reader& reader, unsigned int count)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			DEBUG_ASSERT(count <= reader.size(), "invalid end_read");
+			const unsigned int previous = available();
+			reader.m_position += count;
+			if (available() != previous)
+				m_scheduler.trigger_not_full();
+		}
+
+		/* Position of the reader that is furthest behind */
+		unsigned int slowest() const
+		{
+			unsigned int result = m_position;
+			for (typename std::vector<Reader>::const_iterator it = m_readers.begin(); it != m_readers.end(); ++it)
+				if (m_position - it->m_position > m_position - result)
+					result = it->m_position;
+			return result;
+		}
+
+		/* Start all positions at "position", for testing the wrap
+		 * around of the counters. Only call on an empty queue. */
+		void reset_position(unsigned int position)
+		{
+			m_position = position;
+			for (typename std::vector<Reader>::iterator it = m_readers.begin(); it != m_readers.end(); ++it)
+				it->m_position = position;
+		}
+
+		static unsigned int round_up(unsigned int value)
+		{
+			unsigned int result = 1;
+			while (result < value)
+				result <<= 1;
+			return result;
+		}
+
+		/* A trigger wakes one waiter, so trigger for each */
+		void wake_readers()
+		{
+			for (unsigned int i = 0; i < m_waiting_readers; ++i)
+				m_scheduler.trigger_not_empty();
+		}
+
+		Scheduler m_scheduler;
+		unsigned int m_mask;
+		T* m_buff;
+		unsigned int m_position; /* Total written */
+		unsigned int m_waiting_readers;
+		std::vector<Reader> m_readers;
+	private:
+		BroadcastQueue(const BroadcastQueue&);
+		BroadcastQueue& operator=(const BroadcastQueue&);
+	};
+}
@@ -28,17 +28,40 @@
  */
 #pragma once
 
+#include <stdexcept>
+#include <time.h>
 #include <pthread.h>
 
 namespace dyplo
 {
+	/* Absolute CLOCK_MONOTONIC time, "us" microseconds from now */
+	static inline void monotonic_deadline(struct timespec& result, unsigned int us)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &result);
+		result.tv_sec += us / 1000000;
+		result.tv_nsec += (us % 1000000) * 1000;
+		if (result.tv_nsec >= 1000000000)
+		{
+			result.tv_nsec -= 1000000000;
+			++result.tv_sec;
+		}
+	}
+
 	class Condition
 	{
 		pthread_cond_t m_handle;
 	public:
-		Condition()
+		/* The clock determines how timedwait interprets abstime. Use
+		 * CLOCK_MONOTONIC for timeouts that must not jump along with
+		 * the wall clock. */
+		Condition(clockid_t clock = CLOCK_REALTIME)
 		{
-			int result = pthread_cond_init(&m_handle, NULL);
+			pthread_condattr_t attr;
+			pthread_condattr_init(&attr);
+			int result = pthread_condattr_setclock(&attr, clock);
+			if (result == 0)
+				result = pthread_cond_init(&m_handle, &attr);
+			pthread_condattr_destroy(&attr);
 			if (result != 0) throw std::runtime_error("Failed to create condition");
 		}
 		~Condition()
@@ -49,6 +72,10 @@ namespace dyplo
 		{
 			pthread_cond_signal(&m_handle);
 		}
+		void broadcast()
+		{
+			pthread_cond_broadcast(&m_handle);
+		}
 		void wait(pthread_mutex_t* mutex)
 		{
 			pthread_cond_wait(&m_handle, mutex);
@@ -107,4 +107,39 @@ namespace dyplo
 			Base::interrupt();
 		}
 	};
+
+	/* Processes everything that is available in one go, limited only by
+	 * the room in the output queue. ProcessFunction is called with the
+	 * number of elements, which differs from call to call. */
+	template <
+		class InputQueueClass,
+		class OutputQueueClass,
+		void(*ProcessFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*, unsigned int)>
+	class CooperativeDynamicProcess: public CooperativeProcessBase<InputQueueClass, OutputQueueClass>
+	{
+	public:
+		typedef CooperativeProcessBase<InputQueueClass, OutputQueueClass> Base;
+		/* override */ void process_one()
+		{
+			typename InputQueueClass::Element *src;
+			typename OutputQueueClass::Element *dest;
+			for (;;)
+			{
+				unsigned int count = Base::input->begin_read(src, 0);
+				if (count == 0)
+					return;
+				unsigned int room = Base::output->begin_write(dest, 1);
+				if (count > room)
+					count = room;
+				ProcessFunction(dest, src, count);
+				Base::output->end_write(count);
+				Base::input->end_read(count);
+			}
+		}
+
+		~CooperativeDynamicProcess()
+		{
+			Base::interrupt();
+		}
+	};
 }
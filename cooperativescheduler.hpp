@@ -30,6 +30,7 @@
 
 #include <stdlib.h>
 #include <stdexcept>
+#include <time.h>
 
 namespace dyplo
 {
@@ -66,6 +67,17 @@ namespace dyplo
 		{
 			throw std::runtime_error("Not implemented: wait_until_not_empty");
 		}
+		/* No timers, waiting returns once there is progress */
+		bool wait_until_not_full(const struct timespec&)
+		{
+			wait_until_not_full();
+			return true;
+		}
+		bool wait_until_not_empty(const struct timespec&)
+		{
+			wait_until_not_empty();
+			return true;
+		}
 		void trigger_not_full() const
 		{
 		}
@@ -103,4 +115,167 @@ namespace dyplo
 		}
 	};
 
+	/* Like the CooperativeScheduler, but instead of running the
+	 * downstream process from within end_write, it puts it in a list
+	 * of processes to run. The outermost trigger runs that list until
+	 * it is empty. Each process thus handles everything in its input
+	 * before the next one runs, and the stack does not grow with the
+	 * length of the chain. The list is per thread.
+	 * Only when the queue is full the downstream process is called
+	 * directly, to make room. */
+	class TrampolineScheduler
+	{
+	public:
+		Process* downstream;
+
+		TrampolineScheduler():
+			downstream(NULL),
+			m_next(NULL),
+			m_queued(false)
+		{
+		}
+
+		~TrampolineScheduler()
+		{
+			if (m_queued)
+				unqueue();
+		}
+
+		void process_one()
+		{
+			unlock();
+			downstream->process_one();
+			lock();
+		}
+
+		void wait_until_not_full()
+		{
+			process_one();
+		}
+		void wait_until_not_empty()
+		{
+			throw std::runtime_error("Not implemented: wait_until_not_empty");
+		}
+		/* No timers, waiting returns once there is progress */
+		bool wait_until_not_full(const struct timespec&)
+		{
+			wait_until_not_full();
+			return true;
+		}
+		bool wait_until_not_empty(const struct timespec&)
+		{
+			wait_until_not_empty();
+			return true;
+		}
+		void trigger_not_full() const
+		{
+		}
+		void trigger_not_empty()
+		{
+			if (downstream)
+				schedule();
+		}
+
+		void lock() const
+		{
+		}
+
+		void unlock() const
+		{
+		}
+
+		void interrupt_not_full()
+		{
+			if (downstream)
+				downstream->interrupt();
+		}
+
+		void interrupt_not_empty()
+		{
+		}
+
+		void resume_not_full()
+		{
+			if (downstream)
+				schedule();
+		}
+
+		void resume_not_empty()
+		{
+		}
+	protected:
+		TrampolineScheduler* m_next;
+		bool m_queued;
+
+		struct ReadyList
+		{
+			TrampolineScheduler* head;
+			TrampolineScheduler* tail;
+			bool running;
+		};
+
+		static ReadyList& ready()
+		{
+			static __thread ReadyList list;
+			return list;
+		}
+
+		void schedule()
+		{
+			ReadyList& list = ready();
+			if (!m_queued)
+			{
+				m_queued = true;
+				m_next = NULL;
+				if (list.tail)
+					list.tail->m_next = this;
+				else
+					list.head = this;
+				list.tail = this;
+			}
+			if (list.running)
+				return;
+			/* This is the trampoline */
+			list.running = true;
+			try
+			{
+				while (list.head)
+				{
+					TrampolineScheduler* item = list.head;
+					list.head = item->m_next;
+					if (!list.head)
+						list.tail = NULL;
+					item->m_queued = false;
+					item->downstream->process_one();
+				}
+			}
+			catch (...)
+			{
+				list.running = false;
+				throw;
+			}
+			list.running = false;
+		}
+
+		void unqueue()
+		{
+			ReadyList& list = ready();
+			TrampolineScheduler* previous = NULL;
+			for (TrampolineScheduler* item = list.head; item; item = item->m_next)
+			{
+				if (item == this)
+				{
+					if (previous)
+						previous->m_next = m_next;
+					else
+						list.head = m_next;
+					if (list.tail == this)
+						list.tail = previous;
+					break;
+				}
+				previous = item;
+			}
+			m_queued = false;
+		}
+	};
 }
@@ -0,0 +1,412 @@
+/*
+ * coroutineprocess.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+/* Requires C++20, see COROUTINE_CXXFLAGS in configure */
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <vector>
+#include <time.h>
+#include "exceptions.hpp"
+
+namespace dyplo
+{
+	class CoroutineRunner;
+	class CoroutineScheduler;
+
+	/* Return type of a process written as a coroutine, for example:
+	 *   CoroutineProcess add_one(Queue& input, Queue& output)
+	 *   {
+	 *     for (;;) {
+	 *       int *src, *dest;
+	 *       co_await async_begin_read(input, src, 1);
+	 *       co_await async_begin_write(output, dest, 1);
+	 *       ...
+	 *     }
+	 *   }
+	 * Nothing runs until it is passed to CoroutineRunner::spawn. */
+	class CoroutineProcess
+	{
+	public:
+		struct promise_type
+		{
+			CoroutineRunner* runner;
+			std::exception_ptr exception;
+
+			promise_type(): runner(nullptr) {}
+			CoroutineProcess get_return_object()
+			{
+				return CoroutineProcess(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+			std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+			std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+			void return_void() {}
+			void unhandled_exception() { exception = std::current_exception(); }
+		};
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		CoroutineProcess(CoroutineProcess&& other):
+			m_handle(other.m_handle)
+		{
+			other.m_handle = nullptr;
+		}
+		~CoroutineProcess()
+		{
+			if (m_handle)
+				m_handle.destroy();
+		}
+		Handle release()
+		{
+			Handle result = m_handle;
+			m_handle = nullptr;
+			return result;
+		}
+	private:
+		explicit CoroutineProcess(Handle handle): m_handle(handle) {}
+		CoroutineProcess(const CoroutineProcess&);
+		Handle m_handle;
+	};
+
+	/* Runs coroutine processes on the calling thread. Processes that
+	 * wait for a queue are resumed by the queue's CoroutineScheduler
+	 * once the queue has what they asked for. All processes and queues
+	 * of a runner must be used from one thread; use one runner per
+	 * thread to spread the work. */
+	class CoroutineRunner
+	{
+	public:
+		CoroutineRunner()
+		{
+			this_thread() = this;
+		}
+		~CoroutineRunner()
+		{
+			if (this_thread() == this)
+				this_thread() = nullptr;
+			for (std::vector<CoroutineProcess::Handle>::iterator it = m_processes.begin(); it != m_processes.end(); ++it)
+				it->destroy();
+		}
+
+		void spawn(CoroutineProcess&& process)
+		{
+			CoroutineProcess::Handle handle = process.release();
+			handle.promise().runner = this;
+			m_processes.push_back(handle);
+			schedule(handle);
+		}
+
+		void schedule(std::coroutine_handle<> handle)
+		{
+			m_ready.push_back(handle);
+		}
+
+		/* Resume processes until all of them wait or have finished.
+		 * Returns false when there was nothing to do. An exception
+		 * that ended a process is thrown from here, except for
+		 * InterruptedException. */
+		bool run()
+		{
+			if (m_ready.empty())
+				return false;
+			while (!m_ready.empty())
+			{
+				std::coroutine_handle<> handle = m_ready.front();
+				m_ready.pop_front();
+				handle.resume();
+			}
+			reap();
+			return true;
+		}
+
+		/* Number of processes that have not finished */
+		unsigned int size() const { return m_processes.size(); }
+
+		/* The runner most recently created on the calling thread */
+		static CoroutineRunner*& this_thread()
+		{
+			static thread_local CoroutineRunner* runner = nullptr;
+			return runner;
+		}
+	protected:
+		void reap()
+		{
+			std::exception_ptr failure;
+			unsigned int i = 0;
+			while (i < m_processes.size())
+			{
+				CoroutineProcess::Handle handle = m_processes[i];
+				if (!handle.done())
+				{
+					++i;
+					continue;
+				}
+				if (handle.promise().exception && !failure)
+				{
+					try
+					{
+						std::rethrow_exception(handle.promise().exception);
+					}
+					catch (const InterruptedException&)
+					{
+					}
+					catch (...)
+					{
+						failure = std::current_exception();
+					}
+				}
+				handle.destroy();
+				m_processes.erase(m_processes.begin() + i);
+			}
+			if (failure)
+				std::rethrow_exception(failure);
+		}
+
+		std::deque<std::coroutine_handle<> > m_ready;
+		std::vector<CoroutineProcess::Handle> m_processes;
+	private:
+		CoroutineRunner(const CoroutineRunner&);
+	};
+
+	/* A coroutine suspended on a queue. The waiter and the scheduler
+	 * that holds it unlink each other when either goes away first, so
+	 * destroying a runner with suspended processes before their queues,
+	 * or the other way round, leaves no dangling pointers. */
+	class CoroutineWaiter
+	{
+	public:
+		std::coroutine_handle<> handle;
+		CoroutineRunner* runner;
+		CoroutineScheduler* scheduler;
+		/* Whether the queue now has what the coroutine waits for */
+		virtual bool ready() const = 0;
+	protected:
+		CoroutineWaiter(): runner(nullptr), scheduler(nullptr) {}
+		~CoroutineWaiter();
+	};
+
+	/* Scheduler for queues between coroutine processes. There is no
+	 * locking, queue and processes belong to one runner. A plain
+	 * (non-coroutine) call that would block, such as push_one from the
+	 * main program, runs the runner instead, like the
+	 * CooperativeScheduler does. It throws when that does not help.
+	 * Only the default watermarks are supported. */
+	class CoroutineScheduler
+	{
+	public:
+		CoroutineScheduler():
+			m_reader(nullptr),
+			m_writer(nullptr),
+			m_runner(nullptr),
+			m_interrupted_not_full(false),
+			m_interrupted_not_empty(false)
+		{
+		}
+		~CoroutineScheduler()
+		{
+			if (m_reader)
+				m_reader->scheduler = nullptr;
+			if (m_writer)
+				m_writer->scheduler = nullptr;
+		}
+
+		void wait_until_not_full()
+		{
+			if (m_interrupted_not_full)
+				throw InterruptedException();
+			run();
+		}
+		void wait_until_not_empty()
+		{
+			if (m_interrupted_not_empty)
+				throw InterruptedException();
+			run();
+		}
+		/* No timers, waiting returns once there is progress */
+		bool wait_until_not_full(const struct timespec&)
+		{
+			wait_until_not_full();
+			return true;
+		}
+		bool wait_until_not_empty(const struct timespec&)
+		{
+			wait_until_not_empty();
+			return true;
+		}
+		void trigger_not_full() { wake(m_writer, false); }
+		void trigger_not_empty() { wake(m_reader, false); }
+
+		void lock() const {}
+		void unlock() const {}
+
+		void interrupt_not_full()
+		{
+			m_interrupted_not_full = true;
+			wake(m_writer, true);
+		}
+		void interrupt_not_empty()
+		{
+			m_interrupted_not_empty = true;
+			wake(m_reader, true);
+		}
+		void resume_not_full() { m_interrupted_not_full = false; }
+		void resume_not_empty() { m_interrupted_not_empty = false; }
+
+		/* Called by the awaitables below */
+		bool interrupted_not_full() const { return m_interrupted_not_full; }
+		bool interrupted_not_empty() const { return m_interrupted_not_empty; }
+		void suspend_writer(CoroutineWaiter* waiter)
+		{
+			m_writer = waiter;
+			m_runner = waiter->runner;
+			waiter->scheduler = this;
+		}
+		void suspend_reader(CoroutineWaiter* waiter)
+		{
+			m_reader = waiter;
+			m_runner = waiter->runner;
+			waiter->scheduler = this;
+		}
+		/* The waiter's coroutine frame is being destroyed */
+		void forget(CoroutineWaiter* waiter)
+		{
+			if (m_reader == waiter)
+				m_reader = nullptr;
+			if (m_writer == waiter)
+				m_writer = nullptr;
+			if (m_runner == waiter->runner)
+				m_runner = nullptr;
+		}
+
+		/* Runner for calls from outside. Defaults to the runner of
+		 * the coroutine that waited last, or else the runner of the
+		 * calling thread. */
+		void set_runner(CoroutineRunner* runner) { m_runner = runner; }
+	protected:
+		void wake(CoroutineWaiter*& waiter, bool force)
+		{
+			if (waiter && (force || waiter->ready()))
+			{
+				waiter->runner->schedule(waiter->handle);
+				waiter->scheduler = nullptr;
+				waiter = nullptr;
+			}
+		}
+		void run()
+		{
+			CoroutineRunner* runner = m_runner ? m_runner : CoroutineRunner::this_thread();
+			if (!runner || !runner->run())
+				throw std::runtime_error("Queue would block forever");
+		}
+
+		CoroutineWaiter* m_reader;
+		CoroutineWaiter* m_writer;
+		CoroutineRunner* m_runner;
+		bool m_interrupted_not_full;
+		bool m_interrupted_not_empty;
+	};
+
+	inline CoroutineWaiter::~CoroutineWaiter()
+	{
+		if (scheduler)
+			scheduler->forget(this);
+	}
+
+	template <class Queue> class ReadAwaitable: public CoroutineWaiter
+	{
+	public:
+		ReadAwaitable(Queue& queue, typename Queue::Element* &buffer, unsigned int count):
+			m_queue(queue), m_buffer(buffer), m_count(count)
+		{}
+		bool ready() const { return m_queue.size() >= m_count; }
+		bool await_ready() const { return ready(); }
+		void await_suspend(CoroutineProcess::Handle caller)
+		{
+			handle = caller;
+			runner = caller.promise().runner;
+			if (m_queue.get_scheduler().interrupted_not_empty())
+				runner->schedule(caller);
+			else
+				m_queue.get_scheduler().suspend_reader(this);
+		}
+		unsigned int await_resume()
+		{
+			if (!ready())
+				throw InterruptedException();
+			return m_queue.begin_read(m_buffer, 0);
+		}
+	protected:
+		Queue& m_queue;
+		typename Queue::Element* &m_buffer;
+		unsigned int m_count;
+	};
+
+	template <class Queue> class WriteAwaitable: public CoroutineWaiter
+	{
+	public:
+		WriteAwaitable(Queue& queue, typename Queue::Element* &buffer, unsigned int count):
+			m_queue(queue), m_buffer(buffer), m_count(count)
+		{}
+		bool ready() const { return m_queue.available() >= m_count; }
+		bool await_ready() const { return ready(); }
+		void await_suspend(CoroutineProcess::Handle caller)
+		{
+			handle = caller;
+			runner = caller.promise().runner;
+			if (m_queue.get_scheduler().interrupted_not_full())
+				runner->schedule(caller);
+			else
+				m_queue.get_scheduler().suspend_writer(this);
+		}
+		unsigned int await_resume()
+		{
+			if (!ready())
+				throw InterruptedException();
+			return m_queue.begin_write(m_buffer, 0);
+		}
+	protected:
+		Queue& m_queue;
+		typename Queue::Element* &m_buffer;
+		unsigned int m_count;
+	};
+
+	/* co_await these instead of calling begin_read and begin_write.
+	 * They suspend the process until "count" elements or room are
+	 * available, and then return what begin_read or begin_write
+	 * would. end_read and end_write are called as usual. */
+	template <class Queue> ReadAwaitable<Queue> async_begin_read(Queue& queue, typename Queue::Element* &buffer, unsigned int count)
+	{
+		return ReadAwaitable<Queue>(queue, buffer, count);
+	}
+
+	template <class Queue> WriteAwaitable<Queue> async_begin_write(Queue& queue, typename Queue::Element* &buffer, unsigned int count)
+	{
+		return WriteAwaitable<Queue>(queue, buffer, count);
+	}
+}
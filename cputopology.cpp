@@ -0,0 +1,168 @@
+/*
+ * cputopology.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include "cputopology.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+
+namespace dyplo
+{
+	void parse_cpu_list(const std::string& text, std::vector<int>& result)
+	{
+		std::istringstream input(text);
+		std::string range;
+		while (std::getline(input, range, ','))
+		{
+			const char* start = range.c_str();
+			char* end;
+			long first = strtol(start, &end, 10);
+			if (end == start)
+				continue; /* Empty or trailing newline */
+			long last = first;
+			if (*end == '-')
+				last = strtol(end + 1, NULL, 10);
+			for (long cpu = first; cpu <= last; ++cpu)
+				result.push_back(cpu);
+		}
+	}
+
+	static bool read_line(const std::string& filename, std::string& line)
+	{
+		std::ifstream file(filename.c_str());
+		return std::getline(file, line) ? true : false;
+	}
+
+	static std::string to_string(int value)
+	{
+		std::ostringstream result;
+		result << value;
+		return result.str();
+	}
+
+	CpuTopology::CpuTopology(const char* sysfs_path)
+	{
+		const std::string root(sysfs_path);
+		std::string line;
+		if (read_line(root + "/online", line))
+			parse_cpu_list(line, m_cpus);
+		if (m_cpus.empty())
+			m_cpus.push_back(0);
+		for (std::vector<int>::const_iterator cpu = m_cpus.begin(); cpu != m_cpus.end(); ++cpu)
+		{
+			/* The highest level cache is the last level cache */
+			const std::string cache = root + "/cpu" + to_string(*cpu) + "/cache/index";
+			int best_level = 0;
+			std::vector<int> siblings;
+			for (int index = 0; read_line(cache + to_string(index) + "/level", line); ++index)
+			{
+				int level = atoi(line.c_str());
+				if ((level >= best_level) &&
+					read_line(cache + to_string(index) + "/shared_cpu_list", line))
+				{
+					best_level = level;
+					siblings.clear();
+					parse_cpu_list(line, siblings);
+				}
+			}
+			std::vector<int>& online = m_siblings[*cpu];
+			for (std::vector<int>::const_iterator it = siblings.begin(); it != siblings.end(); ++it)
+				if (std::binary_search(m_cpus.begin(), m_cpus.end(), *it))
+					online.push_back(*it);
+			if (online.empty())
+				online.push_back(*cpu);
+		}
+	}
+
+	const std::vector<int>& CpuTopology::cache_siblings(int cpu) const
+	{
+		std::map<int, std::vector<int> >::const_iterator it = m_siblings.find(cpu);
+		if (it == m_siblings.end())
+			return m_cpus; /* Unknown, anywhere is as good */
+		return it->second;
+	}
+
+	std::vector<int> CpuTopology::near(const std::vector<int>& cpus) const
+	{
+		std::vector<int> result;
+		for (std::vector<int>::const_iterator cpu = cpus.begin(); cpu != cpus.end(); ++cpu)
+		{
+			const std::vector<int>& siblings = cache_siblings(*cpu);
+			result.insert(result.end(), siblings.begin(), siblings.end());
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		return result;
+	}
+
+	std::vector<int> CpuTopology::place_pipeline(unsigned int count) const
+	{
+		/* Order the CPUs so that cache siblings are next to each other */
+		std::vector<int> order;
+		for (std::vector<int>::const_iterator cpu = m_cpus.begin(); cpu != m_cpus.end(); ++cpu)
+		{
+			if (std::find(order.begin(), order.end(), *cpu) != order.end())
+				continue;
+			const std::vector<int>& siblings = cache_siblings(*cpu);
+			for (std::vector<int>::const_iterator it = siblings.begin(); it != siblings.end(); ++it)
+				if (std::find(order.begin(), order.end(), *it) == order.end())
+					order.push_back(*it);
+		}
+		std::vector<int> result;
+		for (unsigned int stage = 0; stage < count; ++stage)
+			result.push_back(order[stage % order.size()]);
+		return result;
+	}
+
+	std::vector<int> CpuTopology::interrupt_cpus(unsigned int irq, const char* procfs_path)
+	{
+		std::vector<int> result;
+		std::string line;
+		if (read_line(std::string(procfs_path) + "/irq/" + to_string(irq) + "/smp_affinity_list", line))
+			parse_cpu_list(line, result);
+		return result;
+	}
+
+	int CpuTopology::find_interrupt(const char* name, const char* procfs_path)
+	{
+		std::ifstream file((std::string(procfs_path) + "/interrupts").c_str());
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.find(name) == std::string::npos)
+				continue;
+			const char* start = line.c_str();
+			char* end;
+			long irq = strtol(start, &end, 10);
+			if ((end != start) && (*end == ':'))
+				return irq;
+		}
+		return -1;
+	}
+}
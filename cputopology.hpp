@@ -0,0 +1,71 @@
+/*
+ * cputopology.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dyplo
+{
+	/* Parse a CPU list like "0-3,6,8-9" as used in sysfs and procfs,
+	 * and append the numbers to result. */
+	void parse_cpu_list(const std::string& text, std::vector<int>& result);
+
+	/* Which CPUs share a cache, as read from sysfs. Used to choose
+	 * ThreadAttributes::cpus so that stages that pass data to each other
+	 * run on CPUs that share their last level cache, and to run threads
+	 * that service a DMA node close to the CPU handling its interrupt. */
+	class CpuTopology
+	{
+	public:
+		CpuTopology(const char* sysfs_path = "/sys/devices/system/cpu");
+
+		/* Online CPUs, in ascending order */
+		const std::vector<int>& cpus() const { return m_cpus; }
+		/* Online CPUs that share the last level cache with "cpu",
+		 * including "cpu" itself */
+		const std::vector<int>& cache_siblings(int cpu) const;
+		/* Online CPUs that share a cache with any of "cpus" */
+		std::vector<int> near(const std::vector<int>& cpus) const;
+		/* One CPU for each of "count" stages of a pipeline. Consecutive
+		 * stages go to CPUs that share a cache. When there are more
+		 * stages than CPUs, the assignment wraps around. */
+		std::vector<int> place_pipeline(unsigned int count) const;
+
+		/* CPUs allowed to handle interrupt "irq" */
+		static std::vector<int> interrupt_cpus(unsigned int irq, const char* procfs_path = "/proc");
+		/* First interrupt whose line in /proc/interrupts contains
+		 * "name", or -1 when there is none */
+		static int find_interrupt(const char* name, const char* procfs_path = "/proc");
+	protected:
+		std::vector<int> m_cpus;
+		std::map<int, std::vector<int> > m_siblings;
+	};
+}
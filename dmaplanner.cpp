@@ -0,0 +1,317 @@
+/*
+ * dmaplanner.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include "dmaplanner.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+namespace dyplo
+{
+	DMARegion::DMARegion(uint32_t base, uint32_t element_size,
+			uint32_t width, uint32_t height, uint32_t pitch):
+		base(base),
+		element_size(element_size),
+		width(width),
+		height(height),
+		depth(1),
+		pitch(pitch ? pitch : width * element_size),
+		slice_pitch(height * (pitch ? pitch : width * element_size)),
+		tile_width(0),
+		tile_height(0)
+	{
+	}
+
+	void DMATransferList::add(uint32_t offset, uint32_t size)
+	{
+		if (!size)
+			return;
+		if (!ranges.empty())
+		{
+			Range& last = ranges.back();
+			if (last.offset + last.size == offset)
+			{
+				last.size += size;
+				return;
+			}
+		}
+		Range range;
+		range.offset = offset;
+		range.size = size;
+		ranges.push_back(range);
+	}
+
+	bool DMATransferList::operator==(const DMATransferList& other) const
+	{
+		if (ranges.size() != other.ranges.size())
+			return false;
+		for (unsigned int i = 0; i < ranges.size(); ++i)
+		{
+			if ((ranges[i].offset != other.ranges[i].offset) ||
+				(ranges[i].size != other.ranges[i].size))
+				return false;
+		}
+		return true;
+	}
+
+	/* One loop level, innermost first */
+	struct PlanLoop
+	{
+		uint32_t count;
+		uint32_t stride;
+		PlanLoop(uint32_t c, uint32_t s): count(c), stride(s) {}
+	};
+	typedef std::vector<PlanLoop> PlanLoops;
+
+	/* A burst repeated over a set of loops */
+	struct PlanSegment
+	{
+		uint32_t offset;
+		uint32_t burst_size;
+		PlanLoops dims;
+	};
+	typedef std::vector<PlanSegment> PlanSegments;
+
+	static bool same_shape(const PlanSegment& a, const PlanSegment& b)
+	{
+		if ((a.burst_size != b.burst_size) || (a.dims.size() != b.dims.size()))
+			return false;
+		for (unsigned int i = 0; i < a.dims.size(); ++i)
+			if ((a.dims[i].count != b.dims[i].count) || (a.dims[i].stride != b.dims[i].stride))
+				return false;
+		return true;
+	}
+
+	/* Consecutive segments that only differ in offset by a constant
+	 * amount become one segment with an extra outer loop. */
+	static void merge_segments(const PlanSegments& input, PlanSegments& output)
+	{
+		unsigned int i = 0;
+		while (i < input.size())
+		{
+			PlanSegment merged = input[i];
+			unsigned int count = 1;
+			if ((i + 1 < input.size()) &&
+				same_shape(input[i], input[i + 1]) &&
+				(input[i + 1].offset > input[i].offset))
+			{
+				const uint32_t stride = input[i + 1].offset - input[i].offset;
+				while ((i + count < input.size()) &&
+					same_shape(input[i], input[i + count]) &&
+					(input[i + count].offset == input[i].offset + count * stride))
+					++count;
+				merged.dims.push_back(PlanLoop(count, stride));
+			}
+			output.push_back(merged);
+			i += count;
+		}
+	}
+
+	static void collapse_dimensions(PlanLoops& dims)
+	{
+		unsigned int i = 0;
+		while (i < dims.size())
+		{
+			if (dims[i].count == 1)
+				dims.erase(dims.begin() + i);
+			else if ((i + 1 < dims.size()) &&
+				(dims[i + 1].stride == dims[i].stride * dims[i].count))
+			{
+				dims[i].count *= dims[i + 1].count;
+				dims.erase(dims.begin() + i + 1);
+			}
+			else
+				++i;
+		}
+	}
+
+	/* Grow the burst over contiguous loops and split it when larger
+	 * than allowed. */
+	static void optimize_segment(PlanSegment& segment, uint32_t element_size, uint32_t max_burst_size)
+	{
+		collapse_dimensions(segment.dims);
+		while (!segment.dims.empty() &&
+			(segment.dims[0].stride == segment.burst_size) &&
+			(!max_burst_size || (segment.burst_size * segment.dims[0].count <= max_burst_size)))
+		{
+			segment.burst_size *= segment.dims[0].count;
+			segment.dims.erase(segment.dims.begin());
+		}
+		if (max_burst_size && (segment.burst_size > max_burst_size))
+		{
+			/* Largest burst that divides the span into equal parts */
+			uint32_t chunk = max_burst_size - (max_burst_size % element_size);
+			while (chunk && (segment.burst_size % chunk))
+				chunk -= element_size;
+			if (!chunk)
+				throw std::invalid_argument("Element larger than maximum burst size");
+			segment.dims.insert(segment.dims.begin(),
+				PlanLoop(segment.burst_size / chunk, chunk));
+			segment.burst_size = chunk;
+			collapse_dimensions(segment.dims);
+		}
+	}
+
+	/* The hardware has three loops, emit more configurations when the
+	 * segment needs more. */
+	static void emit_segment(const PlanSegment& segment, StandalonePlan& plan)
+	{
+		const unsigned int outer = segment.dims.size() > 3 ? segment.dims.size() - 3 : 0;
+		std::vector<uint32_t> index(outer, 0);
+		for (;;)
+		{
+			HardwareDMAFifo::StandaloneConfiguration config;
+			config.offset = segment.offset;
+			for (unsigned int i = 0; i < outer; ++i)
+				config.offset += index[i] * segment.dims[3 + i].stride;
+			config.burst_size = segment.burst_size;
+			uint32_t* const loops[3][2] = {
+				{&config.iterations_a, &config.incr_a},
+				{&config.iterations_b, &config.incr_b},
+				{&config.iterations_c, &config.incr_c},
+			};
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				if (i < segment.dims.size())
+				{
+					*loops[i][0] = segment.dims[i].count;
+					*loops[i][1] = segment.dims[i].stride;
+				}
+				else
+				{
+					*loops[i][0] = 1;
+					*loops[i][1] = 0;
+				}
+			}
+			plan.push_back(config);
+			/* Next combination of the outer loops */
+			unsigned int level = 0;
+			while (level < outer)
+			{
+				if (++index[level] < segment.dims[3 + level].count)
+					break;
+				index[level] = 0;
+				++level;
+			}
+			if (level == outer)
+				break;
+		}
+	}
+
+	static void validate_region(const DMARegion& region)
+	{
+		if (!region.element_size || !region.width || !region.height || !region.depth)
+			throw std::invalid_argument("Empty DMA region");
+		if (region.pitch < region.width * region.element_size)
+			throw std::invalid_argument("DMA region pitch smaller than row");
+		if ((region.depth > 1) && (region.slice_pitch < region.height * region.pitch))
+			throw std::invalid_argument("DMA region slice pitch smaller than plane");
+	}
+
+	StandalonePlan planStandaloneTransfer(const DMARegion& region, uint32_t max_burst_size)
+	{
+		validate_region(region);
+		const uint32_t tile_width =
+			(region.tile_width && region.tile_width < region.width) ?
+				region.tile_width : region.width;
+		const uint32_t tile_height =
+			(region.tile_height && region.tile_height < region.height) ?
+				region.tile_height : region.height;
+		const uint32_t full_tiles_x = region.width / tile_width;
+		const uint32_t remainder_x = region.width % tile_width;
+		const uint32_t tile_rows = (region.height + tile_height - 1) / tile_height;
+		/* One segment per run of full tiles and one per edge tile */
+		PlanSegments segments;
+		for (uint32_t plane = 0; plane < region.depth; ++plane)
+		{
+			for (uint32_t tile_row = 0; tile_row < tile_rows; ++tile_row)
+			{
+				const uint32_t first_row = tile_row * tile_height;
+				const uint32_t rows = std::min(tile_height, region.height - first_row);
+				PlanSegment segment;
+				segment.offset = region.base + plane * region.slice_pitch + first_row * region.pitch;
+				segment.burst_size = tile_width * region.element_size;
+				segment.dims.push_back(PlanLoop(rows, region.pitch));
+				segment.dims.push_back(PlanLoop(full_tiles_x, segment.burst_size));
+				segments.push_back(segment);
+				if (remainder_x)
+				{
+					segment.offset += full_tiles_x * segment.burst_size;
+					segment.burst_size = remainder_x * region.element_size;
+					segment.dims.erase(segment.dims.begin() + 1, segment.dims.end());
+					segments.push_back(segment);
+				}
+			}
+		}
+		/* Combine regular tile rows and planes into loops */
+		PlanSegments merged;
+		merge_segments(segments, merged);
+		segments.clear();
+		merge_segments(merged, segments);
+		StandalonePlan plan;
+		for (PlanSegments::iterator it = segments.begin(); it != segments.end(); ++it)
+		{
+			optimize_segment(*it, region.element_size, max_burst_size);
+			emit_segment(*it, plan);
+		}
+		return plan;
+	}
+
+	void expandStandaloneConfiguration(const HardwareDMAFifo::StandaloneConfiguration& config, DMATransferList& result)
+	{
+		for (uint32_t c = 0; c < config.iterations_c; ++c)
+			for (uint32_t b = 0; b < config.iterations_b; ++b)
+				for (uint32_t a = 0; a < config.iterations_a; ++a)
+					result.add(config.offset +
+						a * config.incr_a + b * config.incr_b + c * config.incr_c,
+						config.burst_size);
+	}
+
+	void expandStandalonePlan(const StandalonePlan& plan, DMATransferList& result)
+	{
+		for (StandalonePlan::const_iterator it = plan.begin(); it != plan.end(); ++it)
+			expandStandaloneConfiguration(*it, result);
+	}
+
+	void expandDMARegion(const DMARegion& region, DMATransferList& result)
+	{
+		validate_region(region);
+		const uint32_t tile_width =
+			(region.tile_width && region.tile_width < region.width) ?
+				region.tile_width : region.width;
+		const uint32_t tile_height =
+			(region.tile_height && region.tile_height < region.height) ?
+				region.tile_height : region.height;
+		for (uint32_t plane = 0; plane < region.depth; ++plane)
+			for (uint32_t ty = 0; ty < region.height; ty += tile_height)
+				for (uint32_t tx = 0; tx < region.width; tx += tile_width)
+					for (uint32_t y = ty; y < std::min(ty + tile_height, region.height); ++y)
+						result.add(region.base + plane * region.slice_pitch +
+							y * region.pitch + tx * region.element_size,
+							std::min(tile_width, region.width - tx) * region.element_size);
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * dmaplanner.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include "hardware.hpp"
+
+namespace dyplo
+{
+	/* Addressing of a StandaloneConfiguration, as implemented by
+	 * expandStandaloneConfiguration below:
+	 *   for c in 0..iterations_c-1
+	 *     for b in 0..iterations_b-1
+	 *       for a in 0..iterations_a-1
+	 *         transfer burst_size bytes at
+	 *           offset + a*incr_a + b*incr_b + c*incr_c
+	 */
+
+	/* Part of a 2D or 3D array in the DMA buffer. Tiles are transferred
+	 * one after the other, row by row within each tile, in row-major
+	 * tile order for each plane. Tiles at the right and bottom edges
+	 * may be smaller. A tile size of 0 means "no tiling". */
+	struct DMARegion
+	{
+		uint32_t base;	/* Offset of first element in bytes */
+		uint32_t element_size;	/* Bytes per element */
+		uint32_t width;	/* Elements per row */
+		uint32_t height;	/* Rows per plane */
+		uint32_t depth;	/* Planes, 1 for 2D */
+		uint32_t pitch;	/* Bytes from row to row */
+		uint32_t slice_pitch;	/* Bytes from plane to plane */
+		uint32_t tile_width;	/* Elements */
+		uint32_t tile_height;	/* Rows */
+
+		/* Untiled 2D region, contiguous rows when pitch is 0 */
+		DMARegion(uint32_t base, uint32_t element_size,
+			uint32_t width, uint32_t height, uint32_t pitch = 0);
+	};
+
+	typedef std::vector<HardwareDMAFifo::StandaloneConfiguration> StandalonePlan;
+
+	/* Sequence of contiguous byte ranges, in transfer order. Adjacent
+	 * ranges are merged when added, so two lists compare equal when
+	 * they transfer the same bytes in the same order, regardless of
+	 * burst sizes. */
+	class DMATransferList
+	{
+	public:
+		struct Range
+		{
+			uint32_t offset;
+			uint32_t size;
+		};
+		void add(uint32_t offset, uint32_t size);
+		void clear() { ranges.clear(); }
+		unsigned int size() const { return ranges.size(); }
+		const Range& operator[](unsigned int index) const { return ranges[index]; }
+		bool operator==(const DMATransferList& other) const;
+		bool operator!=(const DMATransferList& other) const { return !(*this == other); }
+	protected:
+		std::vector<Range> ranges;
+	};
+
+	/* Calculate the standalone configurations that transfer "region",
+	 * using as few configurations and as large bursts as possible.
+	 * Bursts are limited to max_burst_size bytes (0 is unlimited), and
+	 * are a multiple of the element size. Throws std::invalid_argument
+	 * for regions that cannot be described. */
+	StandalonePlan planStandaloneTransfer(const DMARegion& region, uint32_t max_burst_size = 0);
+
+	/* CPU reference implementations, for verification */
+	void expandStandaloneConfiguration(const HardwareDMAFifo::StandaloneConfiguration& config, DMATransferList& result);
+	void expandStandalonePlan(const StandalonePlan& plan, DMATransferList& result);
+	void expandDMARegion(const DMARegion& region, DMATransferList& result);
+}
@@ -0,0 +1,266 @@
+/*
+ * dmaqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include <string.h>
+#include "hardware.hpp"
+#include "filequeue.hpp"
+
+namespace dyplo
+{
+	/* Queues that use the memory mapped blocks of a DMA node as their
+	 * storage, so processes read and write the DMA buffers directly.
+	 * The DMAFifo must be configured in MODE_COHERENT or
+	 * MODE_STREAMING before creating the queue. Any class that has the
+	 * dequeue/enqueue interface of HardwareDMAFifo and converts into a
+	 * file handle can be used instead. Elements are moved as raw memory,
+	 * so only use plain data types. */
+
+	/* Each end_write sends the block to the logic, so request as many
+	 * elements as you can fill in one go. */
+	template <class T, class DMAFifo = HardwareDMAFifo> class DMAOutputQueue
+	{
+	public:
+		typedef T Element;
+		typedef typename DMAFifo::Block Block;
+
+		DMAOutputQueue(FilePollScheduler& scheduler, DMAFifo& fifo):
+			m_fifo(fifo),
+			m_block(NULL),
+			m_scheduler(scheduler)
+		{
+			if (set_non_blocking(m_fifo) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+		}
+
+		/* Return pointer into the DMA block, which holds at least
+		 * count_min elements. Will block until a block is available
+		 * unless count_min is 0. */
+		unsigned int begin_write(T* &buffer, unsigned int count_min)
+		{
+			if (!m_block)
+			{
+				for (;;)
+				{
+					m_block = m_fifo.dequeue();
+					if (m_block)
+						break;
+					if (count_min == 0)
+						return 0;
+					m_scheduler.wait_writeable(m_fifo);
+				}
+			}
+			unsigned int capacity = m_block->size / sizeof(T);
+			if (count_min > capacity)
+				throw std::runtime_error("DMA block smaller than requested");
+			buffer = (T*)m_block->data;
+			return capacity;
+		}
+
+		/* Sends the block to the logic */
+		void end_write(unsigned int count)
+		{
+			if (!count)
+				return; /* Keep the block for the next begin_write */
+			m_block->bytes_used = count * sizeof(T);
+			m_fifo.enqueue(m_block);
+			m_block = NULL;
+		}
+
+		void push_one(const T data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = data;
+			end_write(1);
+		}
+
+		void interrupt_write()
+		{
+			m_scheduler.interrupt();
+		}
+
+		FilePollScheduler& get_scheduler() { return m_scheduler; }
+	protected:
+		DMAFifo& m_fifo;
+		Block* m_block;
+		FilePollScheduler& m_scheduler;
+	};
+
+	/* The constructor hands all blocks to the logic. Data comes
+	 * straight from the DMA blocks, only when a read spans two blocks
+	 * the data is copied into a small carry buffer. */
+	template <class T, class DMAFifo = HardwareDMAFifo> class DMAInputQueue
+	{
+	public:
+		typedef T Element;
+		typedef typename DMAFifo::Block Block;
+
+		DMAInputQueue(FilePollScheduler& scheduler, DMAFifo& fifo):
+			m_fifo(fifo),
+			m_block(NULL),
+			m_offset(0),
+			m_carry_bytes(0),
+			m_reading_carry(false),
+			m_scheduler(scheduler)
+		{
+			if (set_non_blocking(m_fifo) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+			for (unsigned int i = m_fifo.count(); i != 0; --i)
+			{
+				Block* block = m_fifo.dequeue();
+				block->bytes_used = block->size;
+				m_fifo.enqueue(block);
+			}
+		}
+
+		unsigned int begin_read(T* &buffer, unsigned int count_min)
+		{
+			const unsigned int bytes_min = count_min * sizeof(T);
+			if (m_carry_bytes)
+			{
+				/* Top up the carry when it does not hold enough */
+				while (m_carry_bytes < bytes_min)
+				{
+					if (!fetch_block(count_min != 0))
+						break;
+					take_from_block(bytes_min - m_carry_bytes);
+				}
+				m_reading_carry = true;
+				buffer = (T*)&m_carry[0];
+				return m_carry_bytes / sizeof(T);
+			}
+			if (!fetch_block(count_min != 0))
+				return 0;
+			unsigned int available = m_block->bytes_used - m_offset;
+			if (available < bytes_min)
+			{
+				/* Crosses a block boundary, use the carry buffer */
+				take_from_block(available);
+				return begin_read(buffer, count_min);
+			}
+			m_reading_carry = false;
+			buffer = (T*)((char*)m_block->data + m_offset);
+			return available / sizeof(T);
+		}
+
+		void end_read(unsigned int count)
+		{
+			const unsigned int bytes = count * sizeof(T);
+			if (m_reading_carry)
+			{
+				m_carry_bytes -= bytes;
+				if (m_carry_bytes)
+					memmove(&m_carry[0], &m_carry[bytes], m_carry_bytes);
+				return;
+			}
+			if (!bytes)
+				return;
+			m_offset += bytes;
+			if (m_offset + sizeof(T) > m_block->bytes_used)
+			{
+				/* Keep a trailing partial element */
+				if (m_offset < m_block->bytes_used)
+					take_from_block(m_block->bytes_used - m_offset);
+				else
+					release_block();
+			}
+		}
+
+		T pop_one()
+		{
+			T* buffer;
+			begin_read(buffer, 1);
+			T result = *buffer;
+			end_read(1);
+			return result;
+		}
+
+		void interrupt_read()
+		{
+			m_scheduler.interrupt();
+		}
+
+		FilePollScheduler& get_scheduler() { return m_scheduler; }
+	protected:
+		/* Make sure m_block is valid. Returns false if it would block
+		 * and "wait" is not set. */
+		bool fetch_block(bool wait)
+		{
+			while (!m_block)
+			{
+				m_block = m_fifo.dequeue();
+				if (m_block)
+				{
+					m_offset = 0;
+					if (m_block->bytes_used)
+						break;
+					release_block(); /* Skip empty blocks */
+					continue;
+				}
+				if (!wait)
+					return false;
+				m_scheduler.wait_readable(m_fifo);
+			}
+			return true;
+		}
+
+		/* Move up to "bytes" from the current block into the carry */
+		void take_from_block(unsigned int bytes)
+		{
+			unsigned int available = m_block->bytes_used - m_offset;
+			if (bytes > available)
+				bytes = available;
+			if (m_carry.size() < m_carry_bytes + bytes)
+				m_carry.resize(m_carry_bytes + bytes);
+			memcpy(&m_carry[m_carry_bytes], (char*)m_block->data + m_offset, bytes);
+			m_carry_bytes += bytes;
+			m_offset += bytes;
+			if (m_offset >= m_block->bytes_used)
+				release_block();
+		}
+
+		/* Return the block to the logic to be filled again */
+		void release_block()
+		{
+			m_block->bytes_used = m_block->size;
+			m_fifo.enqueue(m_block);
+			m_block = NULL;
+		}
+
+		DMAFifo& m_fifo;
+		Block* m_block;
+		unsigned int m_offset;
+		std::vector<char> m_carry;
+		unsigned int m_carry_bytes;
+		bool m_reading_carry;
+		FilePollScheduler& m_scheduler;
+	};
+}
@@ -0,0 +1,163 @@
+/*
+ * dmaspin.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include "fileio.hpp"
+#include "hardware.hpp"
+
+namespace dyplo
+{
+	/* Tell the CPU we're in a busy loop */
+	static inline void cpu_relax()
+	{
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+		__asm__ __volatile__("yield" ::: "memory");
+#else
+		__asm__ __volatile__("" ::: "memory");
+#endif
+	}
+
+	/* Wraps a DMA fifo to reduce the wake-up latency of dequeue. Instead
+	 * of sleeping in the driver, dequeue first polls the node
+	 * "spin_count" times without blocking. Then it sleeps for 1, 2, 4...
+	 * microseconds up to "backoff_max_us", trying again after each
+	 * sleep. Only then it waits for the interrupt like a regular
+	 * dequeue would. Spinning burns a CPU core, so use it on a core that
+	 * has nothing else to do.
+	 * With "blocking" set to false, dequeue returns NULL instead of
+	 * waiting, so a queue or reactor can do the waiting. */
+	template <class DMAFifo = HardwareDMAFifo> class SpinningDMAFifo
+	{
+	public:
+		typedef typename DMAFifo::Block Block;
+
+		/* How each dequeue was satisfied */
+		struct Statistics
+		{
+			unsigned int spin;
+			unsigned int backoff;
+			unsigned int blocked;
+			unsigned int would_block;
+		};
+
+		SpinningDMAFifo(DMAFifo& fifo, bool direction_from_logic,
+				unsigned int spin_count, unsigned int backoff_max_us = 0,
+				bool blocking = true):
+			m_fifo(fifo),
+			m_events(direction_from_logic ? POLLIN : POLLOUT),
+			m_spin_count(spin_count),
+			m_backoff_max_us(backoff_max_us),
+			m_blocking(blocking)
+		{
+			if (set_non_blocking(m_fifo) != 0)
+				throw IOException();
+			reset_statistics();
+		}
+
+		Block* dequeue()
+		{
+			Block* block;
+			for (unsigned int i = 0; i <= m_spin_count; ++i)
+			{
+				block = m_fifo.dequeue();
+				if (block)
+				{
+					++m_statistics.spin;
+					return block;
+				}
+				cpu_relax();
+			}
+			for (unsigned int us = 1; us <= m_backoff_max_us; us <<= 1)
+			{
+				::usleep(us);
+				block = m_fifo.dequeue();
+				if (block)
+				{
+					++m_statistics.backoff;
+					return block;
+				}
+				/* Doubling again would exceed the limit, or overflow */
+				if (us > m_backoff_max_us / 2)
+					break;
+			}
+			if (!m_blocking)
+			{
+				++m_statistics.would_block;
+				errno = EAGAIN;
+				return NULL;
+			}
+			for (;;)
+			{
+				struct pollfd fds;
+				fds.fd = m_fifo;
+				fds.events = m_events;
+				if (::poll(&fds, 1, -1) < 0)
+				{
+					if (errno != EINTR)
+						throw IOException("poll");
+				}
+				block = m_fifo.dequeue();
+				if (block)
+				{
+					++m_statistics.blocked;
+					return block;
+				}
+			}
+		}
+
+		void enqueue(Block* block) { m_fifo.enqueue(block); }
+		void flush() { m_fifo.flush(); }
+		unsigned int count() const { return m_fifo.count(); }
+		const Block* at(uint32_t id) const { return m_fifo.at(id); }
+		operator int() const { return m_fifo; }
+
+		void set_spin_count(unsigned int value) { m_spin_count = value; }
+		void set_backoff_max_us(unsigned int value) { m_backoff_max_us = value; }
+		const Statistics& statistics() const { return m_statistics; }
+		void reset_statistics()
+		{
+			m_statistics.spin = 0;
+			m_statistics.backoff = 0;
+			m_statistics.blocked = 0;
+			m_statistics.would_block = 0;
+		}
+	protected:
+		DMAFifo& m_fifo;
+		short m_events;
+		unsigned int m_spin_count;
+		unsigned int m_backoff_max_us;
+		bool m_blocking;
+		Statistics m_statistics;
+	};
+}
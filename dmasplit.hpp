@@ -0,0 +1,242 @@
+/*
+ * dmasplit.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "exceptions.hpp"
+#include "fileio.hpp"
+#include "hardware.hpp"
+
+namespace dyplo
+{
+	/* Lets one thread submit blocks to a DMA fifo while another thread
+	 * waits for their completion. The producer thread calls acquire
+	 * and submit, the completion thread calls reap and release.
+	 * Ownership of each block is handed between the threads through
+	 * single-producer single-consumer rings, so the fast path takes no
+	 * locks. A thread only sleeps when its ring is empty.
+	 * When writing, acquire returns empty blocks that the producer
+	 * fills, and reap returns blocks that have been sent. When reading,
+	 * the constructor hands all blocks to the logic, reap returns
+	 * filled blocks and acquire returns processed blocks that submit
+	 * hands to the logic again.
+	 * Blocks must be submitted in the same order as acquired. */
+	template <class DMAFifo = HardwareDMAFifo> class SplitDMAFifo
+	{
+	public:
+		typedef typename DMAFifo::Block Block;
+
+		SplitDMAFifo(DMAFifo& fifo, bool direction_from_logic):
+			m_fifo(fifo),
+			m_events(direction_from_logic ? POLLIN : POLLOUT),
+			m_free(fifo.count()),
+			m_in_flight(fifo.count()),
+			m_interrupt(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+			m_reaping(NULL)
+		{
+			if (set_non_blocking(m_fifo) != 0)
+				throw IOException();
+			for (unsigned int i = m_fifo.count(); i != 0; --i)
+			{
+				Block* block = m_fifo.dequeue();
+				if (direction_from_logic)
+				{
+					block->bytes_used = block->size;
+					submit(block);
+				}
+				else
+					m_free.push(block);
+			}
+		}
+
+		/* Producer: get a block to fill (or to return to the logic) */
+		Block* acquire()
+		{
+			return m_free.wait_pop(m_interrupt);
+		}
+
+		/* Producer: hand the block to the logic */
+		void submit(Block* block)
+		{
+			m_fifo.enqueue(block);
+			m_in_flight.push(block);
+		}
+
+		/* Completion: wait for the oldest submitted block */
+		Block* reap()
+		{
+			if (!m_reaping)
+				m_reaping = m_in_flight.wait_pop(m_interrupt);
+			for (;;)
+			{
+				Block* block = m_fifo.dequeue();
+				if (block)
+				{
+					if (block != m_reaping)
+						throw std::runtime_error("DMA block completed out of order");
+					m_reaping = NULL;
+					return block;
+				}
+				wait(m_fifo, m_events, m_interrupt);
+			}
+		}
+
+		/* Completion: make the block available to acquire again */
+		void release(Block* block)
+		{
+			m_free.push(block);
+		}
+
+		/* Make all waiting calls throw InterruptedException until
+		 * resume is called. */
+		void interrupt()
+		{
+			uint64_t value = 1;
+			if (::write(m_interrupt, &value, sizeof(value)) < 0)
+				throw IOException("eventfd");
+		}
+
+		void resume()
+		{
+			uint64_t value;
+			if (::read(m_interrupt, &value, sizeof(value)) < 0 && errno != EAGAIN)
+				throw IOException("eventfd");
+		}
+
+		unsigned int count() const { return m_fifo.count(); }
+	protected:
+		/* Wait for handle, or throw when interrupted */
+		static void wait(int handle, short events, int interrupt_handle)
+		{
+			struct pollfd fds[2];
+			fds[0].fd = handle;
+			fds[0].events = events;
+			fds[1].fd = interrupt_handle;
+			fds[1].events = POLLIN;
+			if (::poll(fds, 2, -1) < 0)
+			{
+				if (errno == EINTR)
+					return;
+				throw IOException("poll");
+			}
+			if (fds[1].revents)
+				throw InterruptedException();
+		}
+
+		/* Single producer, single consumer ring of block pointers.
+		 * The capacity equals the number of blocks, so it never
+		 * overflows. */
+		class Ring
+		{
+		public:
+			Ring(unsigned int capacity):
+				m_items(capacity),
+				m_read(0),
+				m_write(0),
+				m_sleeping(0),
+				m_wakeup(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+			{
+			}
+
+			void push(Block* block)
+			{
+				unsigned int position = __atomic_load_n(&m_write, __ATOMIC_RELAXED);
+				m_items[position % m_items.size()] = block;
+				__atomic_store_n(&m_write, position + 1, __ATOMIC_SEQ_CST);
+				if (__atomic_load_n(&m_sleeping, __ATOMIC_SEQ_CST))
+				{
+					uint64_t value = 1;
+					if (::write(m_wakeup, &value, sizeof(value)) < 0)
+						throw IOException("eventfd");
+				}
+			}
+
+			Block* pop()
+			{
+				unsigned int position = __atomic_load_n(&m_read, __ATOMIC_RELAXED);
+				if (position == __atomic_load_n(&m_write, __ATOMIC_SEQ_CST))
+					return NULL;
+				Block* result = m_items[position % m_items.size()];
+				__atomic_store_n(&m_read, position + 1, __ATOMIC_RELEASE);
+				return result;
+			}
+
+			Block* wait_pop(int interrupt_handle)
+			{
+				for (;;)
+				{
+					Block* result = pop();
+					if (result)
+						return result;
+					/* Announce sleep, then check again so that a
+					 * concurrent push either sees the flag or
+					 * this sees its item. */
+					__atomic_store_n(&m_sleeping, 1, __ATOMIC_SEQ_CST);
+					result = pop();
+					if (!result)
+					{
+						try
+						{
+							wait(m_wakeup, POLLIN, interrupt_handle);
+						}
+						catch (...)
+						{
+							__atomic_store_n(&m_sleeping, 0, __ATOMIC_SEQ_CST);
+							throw;
+						}
+						uint64_t value;
+						if (::read(m_wakeup, &value, sizeof(value)) < 0 && errno != EAGAIN)
+							throw IOException("eventfd");
+					}
+					__atomic_store_n(&m_sleeping, 0, __ATOMIC_SEQ_CST);
+					if (result)
+						return result;
+				}
+			}
+		protected:
+			std::vector<Block*> m_items;
+			unsigned int m_read;
+			unsigned int m_write;
+			int m_sleeping;
+			File m_wakeup;
+		};
+
+		DMAFifo& m_fifo;
+		short m_events;
+		Ring m_free;
+		Ring m_in_flight;
+		File m_interrupt;
+		Block* m_reaping;
+	};
+}
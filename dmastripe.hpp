@@ -0,0 +1,173 @@
+/*
+ * dmastripe.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include "fileio.hpp"
+#include "hardware.hpp"
+
+namespace dyplo
+{
+	/* Spreads one logical stream over several DMA nodes, one block at a
+	 * time in round-robin order. Has the same dequeue/enqueue interface
+	 * as a single HardwareDMAFifo, so it can be used with the DMA
+	 * queues.
+	 * Blocks are tagged with a sequence number in the (4-bit) user
+	 * signal, the receiving side verifies the tag and throws when a
+	 * block arrives out of order. This means the user signal is not
+	 * available to the application, and that each block sent must
+	 * arrive as exactly one block, so configure the same block size on
+	 * both ends of each node. */
+	template <class DMAFifo = HardwareDMAFifo> class StripedDMAChannel
+	{
+	public:
+		typedef typename DMAFifo::Block Block;
+		static const unsigned int SEQUENCE_MASK = 0xF;
+
+		StripedDMAChannel(const std::vector<DMAFifo*>& fifos, bool direction_from_logic):
+			m_fifos(fifos),
+			m_unprimed(fifos.size()),
+			m_direction_from_logic(direction_from_logic),
+			m_sequence(0)
+		{
+			if (m_fifos.empty())
+				throw std::runtime_error("StripedDMAChannel requires at least one fifo");
+			for (unsigned int i = 0; i < m_fifos.size(); ++i)
+				m_unprimed[i] = direction_from_logic ? m_fifos[i]->count() : 0;
+		}
+
+		/* Returns the next block in sequence, or NULL in non-blocking
+		 * mode. For reading, the first "count()" calls return the
+		 * empty blocks that are to be handed to the logic. */
+		Block* dequeue()
+		{
+			if (m_direction_from_logic)
+			{
+				for (unsigned int i = 0; i < m_fifos.size(); ++i)
+					if (m_unprimed[i])
+						return m_fifos[i]->dequeue();
+			}
+			Block* block = m_fifos[current()]->dequeue();
+			if (!block)
+				return NULL;
+			if (m_direction_from_logic)
+			{
+				if (block->user_signal != (m_sequence & SEQUENCE_MASK))
+					throw std::runtime_error("Striped DMA block out of sequence");
+			}
+			else
+				block->user_signal = m_sequence & SEQUENCE_MASK;
+			++m_sequence;
+			return block;
+		}
+
+		/* Hand block back to the node it came from */
+		void enqueue(Block* block)
+		{
+			unsigned int index = owner(block);
+			if (m_unprimed[index])
+				--m_unprimed[index];
+			m_fifos[index]->enqueue(block);
+		}
+
+		/* Wait until all nodes have sent their blocks */
+		void flush()
+		{
+			for (unsigned int i = 0; i < m_fifos.size(); ++i)
+				m_fifos[i]->flush();
+		}
+
+		/* Total number of blocks over all nodes */
+		unsigned int count() const
+		{
+			unsigned int result = 0;
+			for (unsigned int i = 0; i < m_fifos.size(); ++i)
+				result += m_fifos[i]->count();
+			return result;
+		}
+
+		/* Prepare the receiving side by handing all blocks to the
+		 * logic. The DMA queues do this by themselves. */
+		void prime()
+		{
+			for (unsigned int i = 0; i < m_fifos.size(); ++i)
+			{
+				while (m_unprimed[i])
+				{
+					Block* block = m_fifos[i]->dequeue();
+					block->bytes_used = block->size;
+					enqueue(block);
+				}
+			}
+		}
+
+		unsigned int size() const { return m_fifos.size(); }
+		DMAFifo* at(unsigned int index) const { return m_fifos[index]; }
+
+		/* Handle of the node that the next block will come from, to
+		 * wait for in non-blocking mode. */
+		operator int() const { return *m_fifos[current()]; }
+	protected:
+		unsigned int current() const
+		{
+			return m_sequence % m_fifos.size();
+		}
+
+		unsigned int owner(const Block* block) const
+		{
+			for (unsigned int i = 0; i < m_fifos.size(); ++i)
+			{
+				const DMAFifo* fifo = m_fifos[i];
+				if (fifo->count() &&
+					(block >= fifo->at(0)) &&
+					(block <= fifo->at(fifo->count() - 1)))
+					return i;
+			}
+			throw std::runtime_error("Block does not belong to this StripedDMAChannel");
+		}
+
+		std::vector<DMAFifo*> m_fifos;
+		std::vector<unsigned int> m_unprimed;
+		bool m_direction_from_logic;
+		unsigned int m_sequence;
+	};
+
+	/* Applies to all nodes, so the DMA queues can wait on the channel */
+	template <class DMAFifo> int set_non_blocking(StripedDMAChannel<DMAFifo>& channel)
+	{
+		for (unsigned int i = 0; i < channel.size(); ++i)
+		{
+			int result = set_non_blocking(*channel.at(i));
+			if (result != 0)
+				return result;
+		}
+		return 0;
+	}
+}
@@ -38,6 +38,8 @@
 #include "fileio.hpp"
 #include "scopedlock.hpp"
 #include "noopscheduler.hpp"
+#include "arena.hpp"
+#include "realtimememory.hpp"
 
 namespace dyplo
 {
@@ -83,14 +85,32 @@ namespace dyplo
 			m_file_handle(file_handle),
 			m_writeout_position((char*)m_buff),
 			m_bytes_to_write(0),
-			m_scheduler(scheduler)
+			m_scheduler(scheduler),
+			m_arena(NULL)
+		{
+			if (set_non_blocking(file_handle) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+			RealtimeMemory::prepare(m_buff, capacity * sizeof(T));
+		}
+		/* Buffer taken from "arena" */
+		FileOutputQueue(Arena& arena, FilePollScheduler& scheduler, int file_handle, unsigned int capacity):
+			m_buff(arena.allocate_array<T>(capacity)),
+			m_capacity(capacity),
+			m_file_handle(file_handle),
+			m_writeout_position((char*)m_buff),
+			m_bytes_to_write(0),
+			m_scheduler(scheduler),
+			m_arena(&arena)
 		{
 			if (set_non_blocking(file_handle) != 0)
 				throw std::runtime_error("Failed to set non-blocking mode");
 		}
 		~FileOutputQueue()
 		{
-			delete [] m_buff;
+			if (m_arena)
+				Arena::destroy_array(m_buff, m_capacity);
+			else
+				delete [] m_buff;
 		}
 
 		/* Returns whether caller needs to wait for more */
@@ -175,6 +195,7 @@ namespace dyplo
 		char* m_writeout_position;
 		int m_bytes_to_write;
 		FilePollScheduler& m_scheduler;
+		Arena* m_arena;
 	};
 
 	template <class T> class FileInputQueue
@@ -188,14 +209,32 @@ namespace dyplo
 			m_carry(0),
 			m_size(0),
 			m_file_handle(file_handle),
-			m_scheduler(scheduler)
+			m_scheduler(scheduler),
+			m_arena(NULL)
+		{
+			if (set_non_blocking(file_handle) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+			RealtimeMemory::prepare(m_buff, capacity * sizeof(T));
+		}
+		/* Buffer taken from "arena" */
+		FileInputQueue(Arena& arena, FilePollScheduler& scheduler, int file_handle, unsigned int capacity):
+			m_buff(arena.allocate_array<T>(capacity)),
+			m_capacity(capacity),
+			m_carry(0),
+			m_size(0),
+			m_file_handle(file_handle),
+			m_scheduler(scheduler),
+			m_arena(&arena)
 		{
 			if (set_non_blocking(file_handle) != 0)
 				throw std::runtime_error("Failed to set non-blocking mode");
 		}
 		~FileInputQueue()
 		{
-			delete [] m_buff;
+			if (m_arena)
+				Arena::destroy_array(m_buff, m_capacity);
+			else
+				delete [] m_buff;
 		}
 
 		unsigned int begin_read(T* &buffer, unsigned int count_min)
@@ -288,5 +327,6 @@ namespace dyplo
 		unsigned int m_size;
 		int m_file_handle;
 		FilePollScheduler& m_scheduler;
+		Arena* m_arena;
 	};
 }
@@ -0,0 +1,282 @@
+/*
+ * framequeue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include "generics.hpp"
+#include "scopedlock.hpp"
+#include "realtimememory.hpp"
+
+namespace dyplo
+{
+	/* Queue of variable-length frames in one byte buffer. Each frame
+	 * is stored contiguously behind a small header holding its length
+	 * and user signal, so a message costs no allocation. A frame that
+	 * does not fit at the end of the buffer starts at the beginning.
+	 * The writer reserves room for the largest frame it may produce,
+	 * and commits the actual length. The reader gets one whole frame
+	 * at a time. The user signal corresponds to the framing signals
+	 * of the Dyplo fifos. */
+	template <class Scheduler> class FrameQueue
+	{
+	public:
+		FrameQueue(unsigned int capacity):
+			m_capacity(align(capacity)),
+			m_buff(new char[m_capacity]),
+			m_head(0),
+			m_tail(0),
+			m_used(0),
+			m_frames(0),
+			m_reserved(0),
+			m_reserved_offset(0)
+		{
+			RealtimeMemory::prepare(m_buff, m_capacity);
+		}
+
+		~FrameQueue()
+		{
+			delete [] m_buff;
+		}
+
+		/* Return memory for a frame of up to max_length bytes. Blocks
+		 * until there is room. */
+		void* begin_write(unsigned int max_length)
+		{
+			const unsigned int needed = frame_size(max_length);
+			if (needed > m_capacity)
+				throw std::invalid_argument("Frame larger than FrameQueue");
+			ScopedLock<Scheduler> lock(m_scheduler);
+			while (!reserve(needed))
+				m_scheduler.wait_until_not_full();
+			m_reserved = max_length;
+			return m_buff + m_reserved_offset + sizeof(Header);
+		}
+
+		/* Commit the frame written after begin_write */
+		void end_write(unsigned int length, unsigned int user_signal = 0)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			DEBUG_ASSERT(length <= m_reserved, "invalid end_write");
+			if (m_reserved_offset != m_head)
+			{
+				/* Skip the end of the buffer */
+				if (m_capacity - m_head >= sizeof(Header))
+					header(m_head)->length = wrap_marker;
+				m_used += m_capacity - m_head;
+				m_head = 0;
+			}
+			Header* h = header(m_head);
+			h->length = length;
+			h->user_signal = user_signal;
+			m_head += frame_size(length);
+			m_used += frame_size(length);
+			if (m_head == m_capacity)
+				m_head = 0;
+			++m_frames;
+			m_scheduler.trigger_not_empty();
+		}
+
+		/* Copy a frame into the queue */
+		void push(const void* data, unsigned int length, unsigned int user_signal = 0)
+		{
+			memcpy(begin_write(length), data, length);
+			end_write(length, user_signal);
+		}
+
+		/* Return the oldest frame and its length. Blocks when there
+		 * is none. */
+		unsigned int begin_read(void* &buffer)
+		{
+			unsigned int user_signal;
+			return begin_read(buffer, user_signal);
+		}
+
+		unsigned int begin_read(void* &buffer, unsigned int &user_signal)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			while (m_frames == 0)
+				m_scheduler.wait_until_not_empty();
+			if ((m_capacity - m_tail < sizeof(Header)) || (header(m_tail)->length == wrap_marker))
+			{
+				m_used -= m_capacity - m_tail;
+				m_tail = 0;
+			}
+			const Header* h = header(m_tail);
+			buffer = m_buff + m_tail + sizeof(Header);
+			user_signal = h->user_signal;
+			return h->length;
+		}
+
+		/* Release the frame returned by begin_read */
+		void end_read()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			DEBUG_ASSERT(m_frames != 0, "invalid end_read");
+			const unsigned int size = frame_size(header(m_tail)->length);
+			m_tail += size;
+			m_used -= size;
+			if (m_tail == m_capacity)
+				m_tail = 0;
+			--m_frames;
+			m_scheduler.trigger_not_full();
+		}
+
+		/* Number of frames in the queue */
+		unsigned int size() const { return m_frames; }
+		bool empty() const { return m_frames == 0; }
+		unsigned int capacity() const { return m_capacity; }
+		/* Bytes in use, including headers and padding */
+		unsigned int bytes_used() const { return m_used; }
+
+		void interrupt_read()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.interrupt_not_empty();
+		}
+
+		void interrupt_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.interrupt_not_full();
+		}
+
+		void resume_read()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.resume_not_empty();
+		}
+
+		void resume_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.resume_not_full();
+		}
+
+		Scheduler& get_scheduler() { return m_scheduler; }
+		const Scheduler& get_scheduler() const { return m_scheduler; }
+	protected:
+		struct Header
+		{
+			uint32_t length;
+			uint16_t user_signal;
+			uint16_t reserved;
+		};
+		static const uint32_t wrap_marker = 0xFFFFFFFF;
+
+		static unsigned int align(unsigned int size)
+		{
+			return (size + sizeof(Header) - 1) & ~(sizeof(Header) - 1);
+		}
+		static unsigned int frame_size(unsigned int length)
+		{
+			return sizeof(Header) + align(length);
+		}
+		Header* header(unsigned int offset) const
+		{
+			return (Header*)(m_buff + offset);
+		}
+
+		/* Find a contiguous space, sets m_reserved_offset */
+		bool reserve(unsigned int needed)
+		{
+			if (m_used == 0)
+			{
+				/* Start over to have the whole buffer */
+				m_head = 0;
+				m_tail = 0;
+			}
+			else if (m_used == m_capacity)
+				return false;
+			if (m_head >= m_tail)
+			{
+				if (m_capacity - m_head >= needed)
+				{
+					m_reserved_offset = m_head;
+					return true;
+				}
+				if (m_tail >= needed)
+				{
+					m_reserved_offset = 0;
+					return true;
+				}
+				return false;
+			}
+			if (m_tail - m_head >= needed)
+			{
+				m_reserved_offset = m_head;
+				return true;
+			}
+			return false;
+		}
+
+		Scheduler m_scheduler;
+		unsigned int m_capacity;
+		char* m_buff;
+		unsigned int m_head;	/* Where the next frame goes */
+		unsigned int m_tail;	/* Oldest frame */
+		unsigned int m_used;
+		unsigned int m_frames;
+		unsigned int m_reserved;
+		unsigned int m_reserved_offset;
+	private:
+		FrameQueue(const FrameQueue&);
+		FrameQueue& operator=(const FrameQueue&);
+	};
+
+	/* Send the oldest frame to a CPU fifo (HardwareFifo), setting the
+	 * fifo's user signal to that of the frame */
+	template <class Scheduler, class Fifo> void write_frame(FrameQueue<Scheduler>& queue, Fifo& fifo)
+	{
+		void* data;
+		unsigned int user_signal;
+		unsigned int length = queue.begin_read(data, user_signal);
+		fifo.setUserSignal(user_signal);
+		const char* position = (const char*)data;
+		while (length)
+		{
+			ssize_t bytes = fifo.write(position, length);
+			position += bytes;
+			length -= bytes;
+		}
+		queue.end_read();
+	}
+
+	/* Receive up to max_length bytes from a CPU fifo as one frame, with
+	 * the user signal the fifo reports */
+	template <class Scheduler, class Fifo> unsigned int read_frame(FrameQueue<Scheduler>& queue, Fifo& fifo, unsigned int max_length)
+	{
+		void* data = queue.begin_write(max_length);
+		unsigned int user_signal = fifo.getUserSignal();
+		unsigned int length = fifo.read(data, max_length);
+		queue.end_write(length, user_signal);
+		return length;
+	}
+}
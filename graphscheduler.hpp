@@ -0,0 +1,233 @@
+/*
+ * graphscheduler.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include <time.h>
+#include "exceptions.hpp"
+
+namespace dyplo
+{
+	/* A process in a graph that runs on a single thread without locks.
+	 * "step" performs one firing: it reads and writes its queues as
+	 * usual, and the queues' GraphScheduler runs the neighbouring
+	 * processes when a read or write would block. A source signals the
+	 * end of its data by throwing EndOfInputException from step. */
+	class GraphProcess
+	{
+	public:
+		GraphProcess():
+			m_active(false),
+			m_finished(false)
+		{
+		}
+		virtual ~GraphProcess() {}
+
+		virtual void step() = 0;
+
+		/* Call step, unless the process is already running further up
+		 * the stack, which means that the graph is deadlocked. */
+		void fire()
+		{
+			if (m_finished)
+				throw EndOfInputException();
+			if (m_active)
+				throw std::runtime_error("Deadlock in graph");
+			m_active = true;
+			try
+			{
+				step();
+			}
+			catch (const EndOfFileException&)
+			{
+				m_active = false;
+				m_finished = true;
+				throw;
+			}
+			catch (...)
+			{
+				m_active = false;
+				throw;
+			}
+			m_active = false;
+		}
+
+		bool finished() const { return m_finished; }
+		/* Allow the process to run again after it finished */
+		void restart() { m_finished = false; }
+	protected:
+		bool m_active;
+		bool m_finished;
+	};
+
+	/* Scheduler for queues between GraphProcess objects. A reader that
+	 * finds the queue empty fires the upstream process (pull), a writer
+	 * that finds it full fires the downstream process (push). When the
+	 * upstream process has ended, the reader gets EndOfInputException.
+	 * The trigger methods do nothing, data only moves on demand. */
+	class GraphScheduler
+	{
+	public:
+		GraphProcess* upstream;
+		GraphProcess* downstream;
+
+		GraphScheduler():
+			upstream(NULL),
+			downstream(NULL),
+			m_interrupted_not_full(false),
+			m_interrupted_not_empty(false)
+		{
+		}
+
+		void wait_until_not_full()
+		{
+			if (m_interrupted_not_full)
+				throw InterruptedException();
+			if (!downstream || downstream->finished())
+				throw EndOfOutputException();
+			downstream->fire();
+		}
+		void wait_until_not_empty()
+		{
+			if (m_interrupted_not_empty)
+				throw InterruptedException();
+			if (!upstream)
+				throw EndOfInputException();
+			upstream->fire();
+		}
+		/* No timers, waiting returns once there is progress */
+		bool wait_until_not_full(const struct timespec&)
+		{
+			wait_until_not_full();
+			return true;
+		}
+		bool wait_until_not_empty(const struct timespec&)
+		{
+			wait_until_not_empty();
+			return true;
+		}
+		void trigger_not_full() const
+		{
+		}
+		void trigger_not_empty() const
+		{
+		}
+
+		void lock() const
+		{
+		}
+		void unlock() const
+		{
+		}
+
+		void interrupt_not_full() { m_interrupted_not_full = true; }
+		void interrupt_not_empty() { m_interrupted_not_empty = true; }
+		void resume_not_full() { m_interrupted_not_full = false; }
+		void resume_not_empty() { m_interrupted_not_empty = false; }
+	protected:
+		bool m_interrupted_not_full;
+		bool m_interrupted_not_empty;
+	};
+
+	/* Make "writer" the upstream and "reader" the downstream process
+	 * of a queue that uses the GraphScheduler. Either may be NULL for
+	 * a queue that is written or read from outside the graph. */
+	template <class Queue> void connect(GraphProcess* writer, Queue& queue, GraphProcess* reader)
+	{
+		queue.get_scheduler().upstream = writer;
+		queue.get_scheduler().downstream = reader;
+	}
+
+	/* Drives a graph from its sinks: fires each sink until it ends
+	 * because its input ended. */
+	class GraphExecutor
+	{
+	public:
+		void add_sink(GraphProcess* sink)
+		{
+			m_sinks.push_back(sink);
+		}
+
+		/* Returns when all sinks have finished */
+		void run()
+		{
+			bool busy = true;
+			while (busy)
+			{
+				busy = false;
+				for (std::vector<GraphProcess*>::iterator it = m_sinks.begin(); it != m_sinks.end(); ++it)
+				{
+					if ((*it)->finished())
+						continue;
+					try
+					{
+						(*it)->fire();
+						busy = true;
+					}
+					catch (const EndOfFileException&)
+					{
+						/* Sink has finished */
+					}
+				}
+			}
+		}
+	protected:
+		std::vector<GraphProcess*> m_sinks;
+	};
+
+	/* Processes blocks of "blocksize" elements, the graph equivalent
+	 * of CooperativeProcess */
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessBlockFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*),
+		int blocksize = 1>
+	class GraphFilter: public GraphProcess
+	{
+	public:
+		GraphFilter(InputQueueClass& input, OutputQueueClass& output):
+			m_input(input),
+			m_output(output)
+		{
+		}
+
+		/* override */ void step()
+		{
+			typename InputQueueClass::Element *src;
+			typename OutputQueueClass::Element *dest;
+			m_input.begin_read(src, blocksize);
+			m_output.begin_write(dest, blocksize);
+			ProcessBlockFunction(dest, src);
+			m_output.end_write(blocksize);
+			m_input.end_read(blocksize);
+		}
+	protected:
+		InputQueueClass& m_input;
+		OutputQueueClass& m_output;
+	};
+}
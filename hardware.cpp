@@ -29,6 +29,7 @@
 #include "config.h"
 #include "hardware.hpp"
 #include "directoryio.hpp"
+#include "realtimememory.hpp"
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <errno.h>
@@ -40,6 +41,10 @@
 #include <string.h>
 #include <fstream>
 #include <assert.h>
+#include <algorithm>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include <iostream>
 
@@ -230,6 +235,27 @@ namespace dyplo
 		return -1;
 	}
 
+	static bool ends_with(const std::string& name, size_t length, const char* postfix)
+	{
+		size_t postfix_length = strlen(postfix);
+		return (length > postfix_length) &&
+			(name.compare(length - postfix_length, postfix_length, postfix) == 0);
+	}
+
+	/* Compressed files that this build cannot decompress. Writing them
+	 * raw would program garbage, so they are not candidates. */
+#ifdef HAVE_LIBZ
+	static bool is_unsupported_compression(const std::string& /*name*/)
+	{
+		return false;
+	}
+#else
+	static bool is_unsupported_compression(const std::string& name)
+	{
+		return ends_with(name, name.length(), ".gz");
+	}
+#endif
+
 	unsigned int HardwareContext::getAvailablePartitionsIn(const char* path)
 	{
 		int result = 0;
@@ -242,6 +268,8 @@ namespace dyplo
 				case DT_REG:
 				case DT_LNK:
 				case DT_UNKNOWN:
+					if (is_unsupported_compression(entry->d_name))
+						break;
 					int index = parse_number_from_name(entry->d_name);
 					if (index >= 0)
 						result |= (1 << index);
@@ -259,6 +287,41 @@ namespace dyplo
 		return getAvailablePartitionsIn(path.c_str());
 	}
 
+	/* Returns the length of the compression extension in the name, or
+	 * 0 if it's not a (supported) compressed file. */
+	static size_t get_compression_postfix_length(const std::string& name)
+	{
+		static const char* const postfixes[] = {
+			".rle",
+#ifdef HAVE_LIBZ
+			".gz",
+#endif
+		};
+		for (unsigned int i = 0; i < sizeof(postfixes)/sizeof(postfixes[0]); ++i)
+		{
+			if (ends_with(name, name.length(), postfixes[i]))
+				return strlen(postfixes[i]);
+		}
+		return 0;
+	}
+
+	/* Higher is better. A '.partial' file is preferred over other
+	 * formats, and a compressed file over an uncompressed one. */
+	static int get_partition_preference(const std::string& name)
+	{
+		int result = 0;
+		size_t length = name.length();
+		size_t compressed = get_compression_postfix_length(name);
+		if (compressed)
+		{
+			length -= compressed;
+			result += 1;
+		}
+		if (ends_with(name, length, ".partial"))
+			result += 2;
+		return result;
+	}
+
 	std::string HardwareContext::findPartitionIn(const char* path, int partition)
 	{
 		DirectoryListing dir(path);
@@ -271,6 +334,8 @@ namespace dyplo
 				case DT_REG:
 				case DT_LNK:
 				case DT_UNKNOWN:
+					if (is_unsupported_compression(entry->d_name))
+						break;
 					int index = parse_number_from_name(entry->d_name);
 					if (index == partition)
 					{
@@ -279,30 +344,22 @@ namespace dyplo
 			}
 		}
 
-		if (possible_partitions.size() == 1)
+		// when there are multiple candidates, prefer '.partial' files
+		// and compressed files over the others, otherwise return the
+		// first possibility
+		std::list<std::string>::const_iterator best = possible_partitions.end();
+		int best_score = -1;
+		for (std::list<std::string>::const_iterator it = possible_partitions.begin(); it != possible_partitions.end(); ++it)
 		{
-			// immediately return the first partition in case of only one result
-			return possible_partitions.front();
-		}
-		else if (!possible_partitions.empty())
-		{
-			// multiple possible partitions found.. use the '.partial' file if it is available
-			const std::string PARTIAL_POSTFIX(".partial");
-			for (std::list<std::string>::const_iterator it = possible_partitions.begin(); it != possible_partitions.end(); ++it)
+			int score = get_partition_preference(*it);
+			if (score > best_score)
 			{
-				const std::string& partition_name = *it;
-
-				// check if the partition_name ends with .partial
-				if (partition_name.length() > PARTIAL_POSTFIX.length() &&
-					partition_name.rfind(PARTIAL_POSTFIX) == (partition_name.length() - PARTIAL_POSTFIX.length()))
-				{
-					return partition_name;
-				}
+				best = it;
+				best_score = score;
 			}
-
-			// no '.partial' partitions found, return first possibility
-			return possible_partitions.front();
 		}
+		if (best != possible_partitions.end())
+			return *best;
 
 		return "";
 	}
@@ -647,6 +704,7 @@ namespace dyplo
 						if (::ioctl(handle, DYPLO_IOCDMABLOCK_QUERY, &(*it)) < 0)
 							throw IOException("DYPLO_IOCDMABLOCK_QUERY");
 						it->data = dma_map_single(handle, prot, it->offset, it->size);
+						RealtimeMemory::prepare(it->data, it->size);
 					}
 					break;
 			}
@@ -740,6 +798,18 @@ namespace dyplo
 		}
 	}
 
+	bool operator==(const dyplo::HardwareDMAFifo::StandaloneConfiguration& lhs, const dyplo::HardwareDMAFifo::StandaloneConfiguration& rhs)
+	{
+		return (lhs.offset == rhs.offset) &&
+			(lhs.burst_size == rhs.burst_size) &&
+			(lhs.incr_a == rhs.incr_a) &&
+			(lhs.iterations_a == rhs.iterations_a) &&
+			(lhs.incr_b == rhs.incr_b) &&
+			(lhs.iterations_b == rhs.iterations_b) &&
+			(lhs.incr_c == rhs.incr_c) &&
+			(lhs.iterations_c == rhs.iterations_c);
+	}
+
 	FpgaImageFileWriter::FpgaImageFileWriter(File& output):
 		output_file(output),
 		buffer(malloc(BUFFER_SIZE))
@@ -811,7 +881,287 @@ namespace dyplo
 		}
 	}
 
+	/* Reads from a file, with the option to push back data that was
+	 * already read to detect the file type. */
+	class FileImageStream: public FpgaImageStream
+	{
+	public:
+		FileImageStream(File& file):
+			input(file),
+			unread_size(0)
+		{}
+
+		void unread(const void* data, size_t count)
+		{
+			assert(count <= sizeof(unread_buffer));
+			memcpy(unread_buffer, data, count);
+			unread_size = count;
+		}
+
+		virtual ssize_t read_all(void *buf, size_t count)
+		{
+			size_t bytes = 0;
+			if (unread_size)
+			{
+				bytes = std::min(count, unread_size);
+				memcpy(buf, unread_buffer, bytes);
+				unread_size -= bytes;
+				memmove(unread_buffer, unread_buffer + bytes, unread_size);
+				count -= bytes;
+				if (!count)
+					return bytes;
+				buf = ((char*)buf) + bytes;
+			}
+			return bytes + input.read_all(buf, count);
+		}
+	private:
+		File& input;
+		unsigned char unread_buffer[8];
+		size_t unread_size;
+	};
+
+	/* Buffered input for the decompressors */
+	class CompressedImageInput
+	{
+	public:
+		CompressedImageInput(FpgaImageStream& stream):
+			input(stream),
+			buffer(BUFFER_SIZE),
+			position(0),
+			size(0)
+		{}
+
+		/* Returns number of bytes available, 0 at end of stream */
+		size_t fill()
+		{
+			if (position == size)
+			{
+				position = 0;
+				size = input.read_all(&buffer[0], buffer.size());
+			}
+			return size - position;
+		}
+
+		const unsigned char* data() const { return &buffer[position]; }
+		void consume(size_t count) { position += count; }
+
+		/* Read exactly count bytes, or throw */
+		void read(void *buf, size_t count)
+		{
+			while (count)
+			{
+				size_t bytes = fill();
+				if (!bytes)
+					throw TruncatedFileException();
+				if (bytes > count)
+					bytes = count;
+				memcpy(buf, data(), bytes);
+				consume(bytes);
+				buf = ((char*)buf) + bytes;
+				count -= bytes;
+			}
+		}
+	private:
+		FpgaImageStream& input;
+		std::vector<unsigned char> buffer;
+		size_t position;
+		size_t size;
+	};
+
+	static unsigned int parse_u32(const unsigned char* data)
+	{
+		return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+	}
+
+	static const unsigned int rle_run_flag = 0x8000;
+	static const unsigned int rle_max_count = 0x8000;
+
+	class RLEImageStream: public FpgaImageStream
+	{
+	public:
+		RLEImageStream(FpgaImageStream& stream):
+			input(stream),
+			remaining(0),
+			record_remaining(0),
+			is_run(false)
+		{
+			unsigned char header[8];
+			input.read(header, sizeof(header));
+			if (memcmp(header, RLE_MAGIC, sizeof(RLE_MAGIC)) != 0)
+				throw std::runtime_error("Unrecognized bitstream format");
+			remaining = parse_u32(header + 4);
+		}
+
+		virtual ssize_t read_all(void *buf, size_t count)
+		{
+			unsigned char* dest = (unsigned char*)buf;
+			if (count > remaining)
+				count = remaining;
+			size_t bytes = count;
+			while (count)
+			{
+				if (!record_remaining)
+				{
+					unsigned char control[2];
+					input.read(control, sizeof(control));
+					unsigned int value = parse_u16(control);
+					is_run = (value & rle_run_flag) != 0;
+					record_remaining = ((value & ~rle_run_flag) + 1) * sizeof(unsigned int);
+					if (is_run)
+						input.read(run_word, sizeof(run_word));
+				}
+				size_t chunk = std::min(count, record_remaining);
+				if (is_run)
+				{
+					/* Record may have been split at a non-word boundary */
+					unsigned int phase = (sizeof(run_word) - record_remaining) & (sizeof(run_word) - 1);
+					for (size_t i = 0; i < chunk; ++i)
+						dest[i] = run_word[(phase + i) & (sizeof(run_word) - 1)];
+				}
+				else
+				{
+					input.read(dest, chunk);
+				}
+				dest += chunk;
+				count -= chunk;
+				record_remaining -= chunk;
+			}
+			remaining -= bytes;
+			return bytes;
+		}
+	private:
+		CompressedImageInput input;
+		size_t remaining; /* Uncompressed bytes to go */
+		size_t record_remaining; /* Bytes left in current record */
+		bool is_run;
+		unsigned char run_word[4];
+	};
+
+#ifdef HAVE_LIBZ
+	class ZlibImageStream: public FpgaImageStream
+	{
+	public:
+		ZlibImageStream(FpgaImageStream& stream):
+			input(stream),
+			finished(false)
+		{
+			memset(&zs, 0, sizeof(zs));
+			/* Add 32 to the window bits to detect gzip or zlib headers */
+			if (inflateInit2(&zs, 15 + 32) != Z_OK)
+				throw std::runtime_error("inflateInit failed");
+		}
+
+		~ZlibImageStream()
+		{
+			inflateEnd(&zs);
+		}
+
+		virtual ssize_t read_all(void *buf, size_t count)
+		{
+			zs.next_out = (Bytef*)buf;
+			zs.avail_out = count;
+			while (zs.avail_out && !finished)
+			{
+				size_t available = input.fill();
+				if (!available)
+					throw TruncatedFileException();
+				zs.next_in = (Bytef*)input.data();
+				zs.avail_in = available;
+				int status = inflate(&zs, Z_NO_FLUSH);
+				input.consume(available - zs.avail_in);
+				if (status == Z_STREAM_END)
+					finished = true;
+				else if (status != Z_OK)
+					throw std::runtime_error("Corrupt compressed bitstream");
+			}
+			return count - zs.avail_out;
+		}
+	private:
+		CompressedImageInput input;
+		z_stream zs;
+		bool finished;
+	};
+#endif
+
+	void compressBitstreamRLE(const void *data, size_t size, std::vector<unsigned char>& output)
+	{
+		const unsigned char* src = (const unsigned char*)data;
+		/* Pad the last word with zeroes, the size in the header
+		 * truncates it again. */
+		const size_t words = (size + sizeof(unsigned int) - 1) / sizeof(unsigned int);
+		std::vector<unsigned char> padded;
+		if (size % sizeof(unsigned int))
+		{
+			padded.resize(words * sizeof(unsigned int), 0);
+			memcpy(&padded[0], src, size);
+			src = &padded[0];
+		}
+
+		output.resize(8);
+		memcpy(&output[0], RLE_MAGIC, sizeof(RLE_MAGIC));
+		output[4] = size >> 24;
+		output[5] = size >> 16;
+		output[6] = size >> 8;
+		output[7] = size;
+
+		size_t index = 0;
+		while (index < words)
+		{
+			/* Count identical words */
+			size_t run = 1;
+			while ((index + run < words) && (run < rle_max_count) &&
+				!memcmp(src + (index * 4), src + ((index + run) * 4), 4))
+				++run;
+			if (run >= 3)
+			{
+				unsigned int control = rle_run_flag | (run - 1);
+				output.push_back(control >> 8);
+				output.push_back(control & 0xFF);
+				output.insert(output.end(), src + (index * 4), src + (index * 4) + 4);
+				index += run;
+				continue;
+			}
+			/* Collect literals until the next run of 3 */
+			size_t literal = 0;
+			while ((index + literal < words) && (literal < rle_max_count))
+			{
+				const unsigned char* word = src + ((index + literal) * 4);
+				if ((index + literal + 2 < words) &&
+					!memcmp(word, word + 4, 4) && !memcmp(word, word + 8, 4))
+					break;
+				++literal;
+			}
+			unsigned int control = literal - 1;
+			output.push_back(control >> 8);
+			output.push_back(control & 0xFF);
+			output.insert(output.end(), src + (index * 4), src + ((index + literal) * 4));
+			index += literal;
+		}
+	}
+
 	size_t FpgaImageReader::processFile(File& fpgaImageFile)
+	{
+		FileImageStream input(fpgaImageFile);
+		unsigned char magic[4];
+		ssize_t bytes = input.read_all(magic, sizeof(magic));
+		input.unread(magic, bytes);
+
+		if ((bytes == sizeof(RLE_MAGIC)) && !memcmp(magic, RLE_MAGIC, sizeof(RLE_MAGIC)))
+		{
+			RLEImageStream decompressor(input);
+			return processStream(decompressor);
+		}
+#ifdef HAVE_LIBZ
+		if ((bytes >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b))
+		{
+			ZlibImageStream decompressor(input);
+			return processStream(decompressor);
+		}
+#endif
+		return processStream(input);
+	}
+
+	size_t FpgaImageReader::processStream(FpgaImageStream& stream)
 	{
 		size_t total_data_bytes_processed = 0;
 
@@ -819,7 +1169,7 @@ namespace dyplo
 		unsigned char* buffer_start = &buffer[0];
 		void* cb_buffer;
 
-		ssize_t bytes = fpgaImageFile.read_all(buffer_start, ALIGN_SIZE);
+		ssize_t bytes = stream.read_all(buffer_start, ALIGN_SIZE);
 		if (bytes < 64)
 			throw TruncatedFileException();
 
@@ -877,7 +1227,7 @@ namespace dyplo
 				if (align != 0)
 				{
 					align = ALIGN_SIZE - align; /* number of bytes to read */
-					bytes = fpgaImageFile.read_all(buffer_start + total_bytes, align);
+					bytes = stream.read_all(buffer_start + total_bytes, align);
 					if (bytes < align)
 						throw TruncatedFileException();
 					total_bytes += align;
@@ -893,7 +1243,7 @@ namespace dyplo
 			while (total_bytes < size)
 			{
 				size_t to_read = callback.beginProcessData(&cb_buffer, size - total_bytes);
-				bytes = fpgaImageFile.read_all(buffer_start, to_read);
+				bytes = stream.read_all(buffer_start, to_read);
 				if (bytes < (ssize_t)to_read)
 					throw TruncatedFileException();
 
@@ -937,7 +1287,7 @@ namespace dyplo
 			for(;;)
 			{
 				callback.beginProcessData(&cb_buffer, BUFFER_SIZE);
-				bytes = fpgaImageFile.read_all(cb_buffer, BUFFER_SIZE);
+				bytes = stream.read_all(cb_buffer, BUFFER_SIZE);
 				if (!bytes)
 					break;
 				ssize_t bytes_written = callback.endProcessData(bytes);
@@ -961,7 +1311,8 @@ namespace dyplo
 		cpu_buffer(NULL),
 		control(control),
 		reader(*this),
-		dyplo_user_id_valid(false)
+		dyplo_user_id_valid(false),
+		pending(false)
 	{
 		// check if there is an ICAP node
 		int icap = control.getIcapNodeIndex();
@@ -1016,22 +1367,32 @@ namespace dyplo
 	}
 
 	HardwareProgrammer::~HardwareProgrammer()
+	{
+		if (pending)
+			flush();
+
+		if (dma_writer != NULL)
+			delete dma_writer;
+
+		if (cpu_fifo != NULL)
+			delete cpu_fifo;
+
+		free(cpu_buffer);
+	}
+
+	void HardwareProgrammer::flush()
 	{
 		sendNOP(ESTIMATED_FIFO_SIZE);
 
 		/* Wait for all DMA transactions to finish */
 		if (dma_writer != NULL)
-		{
 			dma_writer->flush();
-			delete dma_writer;
-		}
 
 		/* Flush data written to CPU fifo */
 		if (cpu_fifo != NULL)
-		{
 			cpu_fifo->flush();
-			delete cpu_fifo;
-		}
+
+		pending = false;
 	}
 
 	unsigned int HardwareProgrammer::fromFile(const char *filename)
@@ -1108,6 +1469,7 @@ namespace dyplo
 
 	ssize_t HardwareProgrammer::endProcessData(size_t length_bytes)
 	{
+		pending = true; /* Have the destructor flush it out */
 		if (dma_writer != NULL)
 		{
 			/* Workaround for DMA node only supporting 64-bit writes */
@@ -1138,4 +1500,60 @@ namespace dyplo
 			throw StaticPartialIDMismatchException();
 		}
 	}
+
+	HardwareProgrammingSession::HardwareProgrammingSession(HardwareContext& context, HardwareControl& control):
+		context(context),
+		control(control)
+	{
+	}
+
+	void HardwareProgrammingSession::add(int node, const std::string& filename)
+	{
+		Partition p;
+		p.node = node;
+		p.filename = filename;
+		p.bytes = 0;
+		partitions.push_back(p);
+	}
+
+	bool HardwareProgrammingSession::add(const char* function, int node)
+	{
+		std::string filename = context.findPartition(function, node);
+		if (filename.empty())
+			return false;
+		add(node, filename);
+		return true;
+	}
+
+	void HardwareProgrammingSession::clear()
+	{
+		partitions.clear();
+	}
+
+	unsigned int HardwareProgrammingSession::getNodeMask() const
+	{
+		unsigned int mask = 0;
+		for (std::vector<Partition>::const_iterator it = partitions.begin(); it != partitions.end(); ++it)
+			mask |= (1u << it->node);
+		return mask;
+	}
+
+	unsigned int HardwareProgrammingSession::execute(HardwareProgrammingSessionCallback* callback, bool enable_nodes)
+	{
+		if (partitions.empty())
+			return 0;
+
+		const unsigned int mask = getNodeMask();
+		unsigned int total;
+
+		control.disableNodes(mask);
+		{
+			HardwareProgrammer programmer(context, control);
+			total = program(programmer, callback);
+		}
+		if (enable_nodes)
+			control.enableNodes(mask);
+
+		return total;
+	}
 }
@@ -252,7 +252,28 @@ namespace dyplo
 	static const size_t BUFFER_SIZE = 4 * ALIGN_SIZE;
 	static const size_t ESTIMATED_FIFO_SIZE = 256;
 
+	// Sequential source of bitstream data, e.g. a decompressor
+	class FpgaImageStream
+	{
+	public:
+		virtual ~FpgaImageStream() {}
+		// Same semantics as File::read_all, only returns a short
+		// count at the end of the stream.
+		virtual ssize_t read_all(void *buf, size_t count) = 0;
+	};
+
+	// Compressed bitstream format suitable for the long runs of
+	// identical words in bitstreams. Starts with the "DYRL" magic and
+	// the uncompressed size (32-bit big endian), followed by records
+	// that start with a 16-bit big endian control word. If bit 15 is
+	// set, the next 32-bit word repeats (control & 0x7FFF) + 1 times,
+	// otherwise (control + 1) literal 32-bit words follow.
+	static const char RLE_MAGIC[4] = {'D', 'Y', 'R', 'L'};
+	void compressBitstreamRLE(const void *data, size_t size, std::vector<unsigned char>& output);
+
 	// can read .bit and .bin and .partial files and will output the data to be flashed on the FPGA
+	// Files compressed with compressBitstreamRLE or gzip (when built
+	// with zlib) are decompressed on the fly.
 	class FpgaImageReader
 	{
 	public:
@@ -263,6 +284,8 @@ namespace dyplo
 
 		// returns amount of bytes of FPGA data read
 		size_t processFile(File& fpgaImageFile);
+		// same as processFile, for already decompressed data
+		size_t processStream(FpgaImageStream& stream);
 
 	protected:
 		virtual bool parseDescriptionTag(const char* data, unsigned short size, bool *is_partial, unsigned int *user_id);
@@ -283,6 +306,12 @@ namespace dyplo
 		unsigned int fromFile(const char *filename);
 		unsigned int fromFile(File& file);
 
+		/* Flush out the ICAP queues and wait for all data to arrive.
+		 * Called from the destructor when there is pending data, so
+		 * only needed when you want to know the programming is
+		 * complete while keeping the programmer open. */
+		void flush();
+
 		// FpgaImageReaderCallback interface
 		virtual size_t beginProcessData(void **data, size_t bytes_remaining);
 		virtual ssize_t endProcessData(size_t length_bytes);
@@ -305,5 +334,71 @@ namespace dyplo
 
 		unsigned short dyplo_user_id;
 		bool dyplo_user_id_valid;
+		bool pending;
+	};
+
+	class HardwareProgrammingSessionCallback
+	{
+	public:
+		// Called for each partition as soon as all of its data has
+		// been written to the programmer. The ICAP is flushed only at
+		// the end of the session, so the last partitions may still be
+		// in transit until execute() returns.
+		virtual void partitionProgrammed(int node, const std::string& filename, unsigned int bytes) = 0;
+	};
+
+	// Programs multiple partitions back-to-back using a single
+	// programmer. The nodes are disabled and enabled as a group, and
+	// the ICAP is flushed only once at the end.
+	class HardwareProgrammingSession
+	{
+	public:
+		struct Partition
+		{
+			int node;
+			std::string filename;
+			unsigned int bytes; /* Bytes programmed, 0 when not yet done */
+		};
+
+		HardwareProgrammingSession(HardwareContext& context, HardwareControl& control);
+
+		/* Queue a bitstream file for the given node */
+		void add(int node, const std::string& filename);
+		/* Queue the bitstream for "function" in partition "node". Returns
+		 * false if there is no bitstream for that partition. */
+		bool add(const char* function, int node);
+		void clear();
+
+		/* Bitmask of all nodes in this session */
+		unsigned int getNodeMask() const;
+		unsigned int size() const { return partitions.size(); }
+		const Partition& at(unsigned int index) const { return partitions[index]; }
+
+		/* Disable all nodes, program all bitstreams and flush. When
+		 * enable_nodes is set, the nodes are enabled again afterwards.
+		 * Returns the total amount of bytes programmed. An empty session
+		 * does not touch the hardware. */
+		unsigned int execute(HardwareProgrammingSessionCallback* callback = NULL, bool enable_nodes = true);
+
+		/* Program all bitstreams through "programmer", reporting each
+		 * partition, and flush once. Used by execute, "Programmer"
+		 * needs fromFile(const char*) and flush(). */
+		template <class Programmer> unsigned int program(Programmer& programmer, HardwareProgrammingSessionCallback* callback = NULL)
+		{
+			unsigned int total = 0;
+			for (std::vector<Partition>::iterator it = partitions.begin(); it != partitions.end(); ++it)
+			{
+				it->bytes = programmer.fromFile(it->filename.c_str());
+				total += it->bytes;
+				if (callback)
+					callback->partitionProgrammed(it->node, it->filename, it->bytes);
+			}
+			programmer.flush();
+			return total;
+		}
+	protected:
+		HardwareContext& context;
+		HardwareControl& control;
+		std::vector<Partition> partitions;
 	};
 }
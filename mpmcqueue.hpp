@@ -0,0 +1,373 @@
+/*
+ * mpmcqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <stdexcept>
+#include "generics.hpp"
+#include "scopedlock.hpp"
+#include "realtimememory.hpp"
+
+namespace dyplo
+{
+	/* The slot that a thread reserved with begin_read or begin_write,
+	 * per queue, until the matching end_ call. A thread can hold
+	 * reservations on at most max_queues queues for reading and
+	 * max_queues for writing at the same time. */
+	class MPMCReservations
+	{
+	public:
+		static const unsigned int max_queues = 8;
+
+		/* Throws when the thread has no room left for a reservation on
+		 * "queue", so the caller can bail out before claiming a slot. */
+		static void check(bool write, const void* queue)
+		{
+			if (!find(write, queue) && !find(write, NULL))
+				throw std::logic_error(write ?
+					"Thread is writing to more than 8 MPMC queues at once" :
+					"Thread is reading from more than 8 MPMC queues at once");
+		}
+
+		static void set(bool write, const void* queue, void* cell)
+		{
+			Entry* entry = find(write, queue);
+			if (!entry)
+				entry = find(write, NULL);
+			entry->queue = queue;
+			entry->cell = cell;
+		}
+
+		/* Returns NULL when the thread holds no reservation */
+		static void* take(bool write, const void* queue)
+		{
+			Entry* entry = find(write, queue);
+			if (!entry)
+				return NULL;
+			entry->queue = NULL;
+			return entry->cell;
+		}
+	protected:
+		struct Entry
+		{
+			const void* queue;
+			void* cell;
+		};
+
+		static Entry* find(bool write, const void* queue)
+		{
+			static __thread Entry entries[2][max_queues];
+			Entry* table = entries[write ? 1 : 0];
+			for (unsigned int i = 0; i < max_queues; ++i)
+				if (table[i].queue == queue)
+					return &table[i];
+			return NULL;
+		}
+	};
+
+	/* Bounded queue for any number of readers and writers. Each slot
+	 * carries a sequence number that tells whether it is free or holds
+	 * data for the current round, so readers and writers claim slots
+	 * with a single compare-and-swap and never take a lock, except to
+	 * sleep when the queue is full or empty.
+	 * Elements are transferred one at a time: begin_write and
+	 * begin_read return at most 1, and each thread must call the
+	 * matching end_ before it begins on the same queue again. A thread
+	 * can be between begin_ and end_ on at most
+	 * MPMCReservations::max_queues (8) queues at a time, per direction,
+	 * beyond that begin_ throws a std::logic_error. An
+	 * end_write(0) leaves the slot empty, readers skip it. A slot read
+	 * is always consumed, even by end_read(0). Like with the other
+	 * queues, end_write(0) and end_read(0) may follow a begin_ call that
+	 * returned 0, they do nothing then.
+	 * The capacity is rounded up to a power of two. The scheduler is
+	 * only used for sleeping, use the PthreadScheduler. */
+	template <class T, class Scheduler> class MPMCQueue
+	{
+	public:
+		typedef T Element;
+
+		MPMCQueue(unsigned int capacity):
+			m_mask(round_up(capacity) - 1),
+			m_cells(new Cell[m_mask + 1]),
+			m_write_position(0),
+			m_read_position(0),
+			m_waiting_writers(0),
+			m_waiting_readers(0)
+		{
+			for (unsigned int i = 0; i <= m_mask; ++i)
+				m_cells[i].sequence = i;
+			RealtimeMemory::prepare(m_cells, (m_mask + 1) * sizeof(Cell));
+		}
+
+		~MPMCQueue()
+		{
+			delete [] m_cells;
+		}
+
+		/* Reserve a slot. Blocks while the queue is full, unless
+		 * count_min is 0, then it returns 0 instead. */
+		unsigned int begin_write(T* &buffer, unsigned int count_min)
+		{
+			MPMCReservations::check(true, this);
+			Cell* cell = reserve_write();
+			if (!cell && count_min)
+			{
+				ScopedLock<Scheduler> lock(m_scheduler);
+				Waiting waiting(m_waiting_writers);
+				while (!(cell = reserve_write()))
+					m_scheduler.wait_until_not_full();
+			}
+			if (!cell)
+				return 0;
+			MPMCReservations::set(true, this, cell);
+			buffer = &cell->data;
+			return 1;
+		}
+
+		void end_write(unsigned int count)
+		{
+			Cell* cell = (Cell*)MPMCReservations::take(true, this);
+			if (!cell)
+			{
+				/* After a begin_write that returned 0 */
+				if (count)
+					throw std::logic_error("MPMC queue end_write without begin_write");
+				return;
+			}
+			DEBUG_ASSERT(count <= 1, "invalid end_write");
+			cell->valid = (count != 0);
+			__atomic_store_n(&cell->sequence, cell->sequence + 1, __ATOMIC_RELEASE);
+			wake(m_waiting_readers, false);
+		}
+
+		/* Claim the oldest element. Blocks while the queue is empty,
+		 * unless count_min is 0, then it returns 0 instead. */
+		unsigned int begin_read(T* &buffer, unsigned int count_min)
+		{
+			MPMCReservations::check(false, this);
+			Cell* cell = reserve_read();
+			if (!cell && count_min)
+			{
+				ScopedLock<Scheduler> lock(m_scheduler);
+				Waiting waiting(m_waiting_readers);
+				while (!(cell = reserve_read()))
+					m_scheduler.wait_until_not_empty();
+			}
+			if (!cell)
+				return 0;
+			MPMCReservations::set(false, this, cell);
+			buffer = &cell->data;
+			return 1;
+		}
+
+		void end_read(unsigned int count)
+		{
+			Cell* cell = (Cell*)MPMCReservations::take(false, this);
+			if (!cell)
+			{
+				/* After a begin_read that returned 0 */
+				if (count)
+					throw std::logic_error("MPMC queue end_read without begin_read");
+				return;
+			}
+			release(cell);
+		}
+
+		void push_one(const T data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = data;
+			end_write(1);
+		}
+
+		T pop_one()
+		{
+			T* buffer;
+			begin_read(buffer, 1);
+			T result = *buffer;
+			end_read(1);
+			return result;
+		}
+
+		unsigned int capacity() const { return m_mask + 1; }
+		/* Only a snapshot when other threads are active */
+		unsigned int size() const
+		{
+			return __atomic_load_n(&m_write_position, __ATOMIC_ACQUIRE) -
+				__atomic_load_n(&m_read_position, __ATOMIC_ACQUIRE);
+		}
+		bool empty() const { return size() == 0; }
+
+		/* Interrupt all threads waiting in begin_write */
+		void interrupt_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.interrupt_not_full();
+			for (unsigned int i = m_waiting_writers; i > 1; --i)
+				m_scheduler.trigger_not_full();
+		}
+
+		/* Interrupt all threads waiting in begin_read */
+		void interrupt_read()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.interrupt_not_empty();
+			for (unsigned int i = m_waiting_readers; i > 1; --i)
+				m_scheduler.trigger_not_empty();
+		}
+
+		void resume_write()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.resume_not_full();
+		}
+
+		void resume_read()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.resume_not_empty();
+		}
+
+		Scheduler& get_scheduler() { return m_scheduler; }
+		const Scheduler& get_scheduler() const { return m_scheduler; }
+	protected:
+		struct Cell
+		{
+			unsigned int sequence;
+			bool valid;
+			T data;
+		};
+
+		/* Counts the threads sleeping on the scheduler */
+		class Waiting
+		{
+			unsigned int& m_count;
+		public:
+			Waiting(unsigned int& count): m_count(count)
+			{
+				__atomic_add_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			}
+			~Waiting()
+			{
+				__atomic_sub_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+			}
+		};
+
+		static unsigned int round_up(unsigned int value)
+		{
+			unsigned int result = 1;
+			while (result < value)
+				result <<= 1;
+			return result;
+		}
+
+		Cell* reserve_write()
+		{
+			unsigned int position = __atomic_load_n(&m_write_position, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				Cell* cell = &m_cells[position & m_mask];
+				int difference = (int)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - position);
+				if (difference == 0)
+				{
+					if (__atomic_compare_exchange_n(&m_write_position, &position, position + 1,
+							true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						return cell;
+				}
+				else if (difference < 0)
+					return NULL; /* Full */
+				else
+					position = __atomic_load_n(&m_write_position, __ATOMIC_RELAXED);
+			}
+		}
+
+		Cell* reserve_read()
+		{
+			unsigned int position = __atomic_load_n(&m_read_position, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				Cell* cell = &m_cells[position & m_mask];
+				int difference = (int)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (position + 1));
+				if (difference == 0)
+				{
+					if (__atomic_compare_exchange_n(&m_read_position, &position, position + 1,
+							true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					{
+						if (cell->valid)
+							return cell;
+						release(cell); /* Cancelled write */
+						position = __atomic_load_n(&m_read_position, __ATOMIC_RELAXED);
+					}
+				}
+				else if (difference < 0)
+					return NULL; /* Empty */
+				else
+					position = __atomic_load_n(&m_read_position, __ATOMIC_RELAXED);
+			}
+		}
+
+		void release(Cell* cell)
+		{
+			/* Free for the writer of the next round */
+			__atomic_store_n(&cell->sequence, cell->sequence + m_mask, __ATOMIC_RELEASE);
+			wake(m_waiting_writers, true);
+		}
+
+		void wake(unsigned int& waiting, bool writers)
+		{
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&waiting, __ATOMIC_RELAXED))
+			{
+				ScopedLock<Scheduler> lock(m_scheduler);
+				if (writers)
+					m_scheduler.trigger_not_full();
+				else
+					m_scheduler.trigger_not_empty();
+			}
+		}
+
+		Scheduler m_scheduler;
+		unsigned int m_mask;
+		Cell* m_cells;
+		/* Separate cache lines for the positions written by writers
+		 * and by readers */
+		char m_padding0[64];
+		unsigned int m_write_position;
+		char m_padding1[64];
+		unsigned int m_read_position;
+		char m_padding2[64];
+		unsigned int m_waiting_writers;
+		unsigned int m_waiting_readers;
+	private:
+		MPMCQueue(const MPMCQueue&);
+		MPMCQueue& operator=(const MPMCQueue&);
+	};
+}
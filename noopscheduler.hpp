@@ -28,6 +28,8 @@
  */
 #pragma once
 
+#include <time.h>
+
 namespace dyplo
 {
 	class NoopScheduler
@@ -36,6 +38,17 @@ namespace dyplo
 		/* wait_ and trigger_ methods are to be called with the lock held */
 		void wait_until_not_full();
 		void wait_until_not_empty();
+		/* No timers either */
+		bool wait_until_not_full(const struct timespec&)
+		{
+			wait_until_not_full();
+			return true;
+		}
+		bool wait_until_not_empty(const struct timespec&)
+		{
+			wait_until_not_empty();
+			return true;
+		}
 		void trigger_not_full()
 		{
 		}
@@ -26,6 +26,7 @@
  * You can contact Topic by electronic mail via info@topic.nl or via
  * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
  */
+#include <errno.h>
 #include "pthreadscheduler.hpp"
 
 namespace dyplo
@@ -36,6 +37,8 @@ namespace dyplo
 	}
 
 	PthreadScheduler::PthreadScheduler():
+		m_condition_not_full(CLOCK_MONOTONIC),
+		m_condition_not_empty(CLOCK_MONOTONIC),
 		m_interrupted_not_full(false),
 		m_interrupted_not_empty(false)
 	{
@@ -54,6 +57,19 @@ namespace dyplo
 		m_condition_not_empty.wait(m_mutex);
 	}
 
+	bool PthreadScheduler::wait_until_not_full(const struct timespec& deadline)
+	{
+		if (m_interrupted_not_full)
+			throw InterruptedException();
+		return m_condition_not_full.timedwait(m_mutex, &deadline) != ETIMEDOUT;
+	}
+	bool PthreadScheduler::wait_until_not_empty(const struct timespec& deadline)
+	{
+		if (m_interrupted_not_empty)
+			throw InterruptedException();
+		return m_condition_not_empty.timedwait(m_mutex, &deadline) != ETIMEDOUT;
+	}
+
 	void PthreadScheduler::trigger_not_full()
 	{
 		m_condition_not_full.signal();
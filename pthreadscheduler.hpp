@@ -48,6 +48,10 @@ namespace dyplo
 		/* wait_ and trigger_ methods are to be called with the lock held */
 		void wait_until_not_full();
 		void wait_until_not_empty();
+		/* Wait with a CLOCK_MONOTONIC deadline, return false when
+		 * the deadline passed. */
+		bool wait_until_not_full(const struct timespec& deadline);
+		bool wait_until_not_empty(const struct timespec& deadline);
 		void trigger_not_full();
 		void trigger_not_empty();
 
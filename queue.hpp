@@ -29,11 +29,30 @@
 #pragma once
 
 #include <stdexcept>
+#include <algorithm>
+#include <time.h>
+#include <utility>
 #include "generics.hpp"
 #include "scopedlock.hpp"
+#include "arena.hpp"
+#include "realtimememory.hpp"
+#include "condition.hpp"
 
 namespace dyplo
 {
+	/* Circular buffer queue. The Scheduler provides the locking and
+	 * waiting, every scheduler must implement:
+	 *  lock(), unlock()
+	 *  wait_until_not_full(), wait_until_not_empty()
+	 *  bool wait_until_not_full(const struct timespec& deadline),
+	 *  bool wait_until_not_empty(const struct timespec& deadline)
+	 *    Timed waits against a CLOCK_MONOTONIC deadline, returning
+	 *    false on timeout. Schedulers without timers may wait
+	 *    untimed and return true.
+	 *  trigger_not_full(), trigger_not_empty()
+	 *  interrupt_not_full(), interrupt_not_empty(),
+	 *  resume_not_full(), resume_not_empty()
+	 * The wait_ and trigger_ methods are called with the lock held. */
 	template <class T, class Scheduler> class FixedMemoryQueueImpl
 	{
 	public:
@@ -45,7 +64,12 @@ namespace dyplo
 			m_end(m_buff + capacity),
 			m_first(m_buff),
 			m_last(m_buff),
-			m_size(0)
+			m_size(0),
+			m_read_watermark(1),
+			m_write_watermark(1),
+			m_read_timeout_us(0),
+			m_read_wanted(0),
+			m_write_wanted(0)
 		{}
 
 		void clear()
@@ -79,9 +103,11 @@ namespace dyplo
 		void end_write(unsigned int count)
 		{
 			ScopedLock<Scheduler> lock(m_scheduler);
+			const unsigned int previous = m_size;
 			m_first = increment(m_first, count);
 			m_size += count;
-			m_scheduler.trigger_not_empty();
+			if (crossed(previous, m_size, m_read_watermark, m_read_wanted))
+				m_scheduler.trigger_not_empty();
 		}
 
 		/* Return pointer to memory of count bytes. Blocks if
@@ -91,14 +117,19 @@ namespace dyplo
 			ScopedLock<Scheduler> lock(m_scheduler);
 			wait_until_not_empty(count_min);
 			buffer = m_last;
-			unsigned int result;
-			if (m_first > m_last)
-				result =  m_first - m_last;
-			else if (m_size)
-				result = m_end - m_last;
-			else
-				result = 0;
-			return result;
+			return readable();
+		}
+
+		/* Like begin_read, but stops waiting for count_min elements
+		 * at "deadline" (CLOCK_MONOTONIC) and returns whatever is
+		 * available at that time, which may be 0. With a scheduler
+		 * that has no timers, this waits like begin_read. */
+		unsigned int begin_read(T* &buffer, unsigned int count_min, const struct timespec& deadline)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			wait_until_not_empty(count_min, deadline);
+			buffer = m_last;
+			return readable();
 		}
 
 		/* Notify queue that count bytes have been consumed and
@@ -106,21 +137,50 @@ namespace dyplo
 		void end_read(unsigned int count)
 		{
 			ScopedLock<Scheduler> lock(m_scheduler);
+			const unsigned int previous = available();
 			m_last = increment(m_last, count);
 			DEBUG_ASSERT(m_size >= count, "invalid end_read");
 			m_size -= count;
-			m_scheduler.trigger_not_full();
+			if (crossed(previous, available(), m_write_watermark, m_write_wanted))
+				m_scheduler.trigger_not_full();
 		}
 
 		void wait_empty()
 		{
 			ScopedLock<Scheduler> lock(m_scheduler);
-			for(;;)
-			{
-				if (empty())
-					return;
-				m_scheduler.wait_until_not_full();
-			}
+			wait_until_not_full(capacity());
+		}
+
+		/* Watermarks reduce the number of wakeups. The reader is only
+		 * triggered when the number of elements in the queue reaches
+		 * the read watermark, the writer only when the free room
+		 * reaches the write watermark, or when a waiting reader or
+		 * writer asked for more. A watermark of 1 (the default)
+		 * triggers on every end_write and end_read.
+		 * A reader that waits below the read watermark looks again
+		 * every timeout_us, so when the writer slows down or stops,
+		 * the last elements arrive late instead of never. With a
+		 * timeout of 0 only the watermark or flush wakes the reader. */
+		void set_read_watermark(unsigned int value, unsigned int timeout_us = 1000)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_read_watermark = value;
+			m_read_timeout_us = timeout_us;
+		}
+		void set_write_watermark(unsigned int value)
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_write_watermark = value;
+		}
+		unsigned int read_watermark() const { return m_read_watermark; }
+		unsigned int write_watermark() const { return m_write_watermark; }
+
+		/* Trigger reader and writer regardless of watermarks */
+		void flush()
+		{
+			ScopedLock<Scheduler> lock(m_scheduler);
+			m_scheduler.trigger_not_empty();
+			m_scheduler.trigger_not_full();
 		}
 
 		unsigned int capacity() const { return m_end - m_buff; }
@@ -129,7 +189,7 @@ namespace dyplo
 		bool empty() const { return size() == 0; }
 		bool full() const { return size() == capacity(); }
 
-		void push_one(const T data)
+		void push_one(const T& data)
 		{
 			T* buffer;
 			begin_write(buffer, 1);
@@ -137,11 +197,25 @@ namespace dyplo
 			end_write(1);
 		}
 
+#if __cplusplus >= 201103L
+		void push_one(T&& data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = std::move(data);
+			end_write(1);
+		}
+#endif
+
 		T pop_one()
 		{
 			T* buffer;
 			begin_read(buffer, 1);
+#if __cplusplus >= 201103L
+			T result(std::move(*buffer));
+#else
 			T result = *buffer;
+#endif
 			end_read(1);
 			return result;
 		}
@@ -173,16 +247,100 @@ namespace dyplo
 		Scheduler& get_scheduler() { return m_scheduler; }
 		const Scheduler& get_scheduler() const { return m_scheduler; }
 	protected:
+		/* While waiting, tell the other side that there's no use in
+		 * holding back because of its watermark. */
 		void wait_until_not_full(unsigned int count)
 		{
 			while (available() < count)
-				m_scheduler.wait_until_not_full();
+			{
+				m_write_wanted = count;
+				if (m_read_watermark > 1)
+					m_scheduler.trigger_not_empty();
+				try
+				{
+					m_scheduler.wait_until_not_full();
+				}
+				catch (...)
+				{
+					m_write_wanted = 0;
+					throw;
+				}
+			}
+			m_write_wanted = 0;
 		}
 
 		void wait_until_not_empty(unsigned int count)
 		{
 			while (size() < count)
-				m_scheduler.wait_until_not_empty();
+			{
+				m_read_wanted = count;
+				if (m_write_watermark > 1)
+					m_scheduler.trigger_not_full();
+				try
+				{
+					if ((m_read_watermark > 1) && m_read_timeout_us)
+					{
+						/* The writer may be holding back because
+						 * of the watermark */
+						struct timespec deadline;
+						monotonic_deadline(deadline, m_read_timeout_us);
+						m_scheduler.wait_until_not_empty(deadline);
+					}
+					else
+						m_scheduler.wait_until_not_empty();
+				}
+				catch (...)
+				{
+					m_read_wanted = 0;
+					throw;
+				}
+			}
+			m_read_wanted = 0;
+		}
+
+		void wait_until_not_empty(unsigned int count, const struct timespec& deadline)
+		{
+			while (size() < count)
+			{
+				m_read_wanted = count;
+				if (m_write_watermark > 1)
+					m_scheduler.trigger_not_full();
+				bool signalled;
+				try
+				{
+					signalled = m_scheduler.wait_until_not_empty(deadline);
+				}
+				catch (...)
+				{
+					m_read_wanted = 0;
+					throw;
+				}
+				if (!signalled)
+					break;
+			}
+			m_read_wanted = 0;
+		}
+
+		/* Number of contiguous elements at m_last */
+		unsigned int readable() const
+		{
+			if (m_first > m_last)
+				return m_first - m_last;
+			else if (m_size)
+				return m_end - m_last;
+			else
+				return 0;
+		}
+
+		/* Whether the level crossed the watermark, or what the other
+		 * side is waiting for when that is more */
+		bool crossed(unsigned int previous, unsigned int current,
+			unsigned int watermark, unsigned int wanted) const
+		{
+			if (watermark <= 1)
+				return true;
+			const unsigned int level = std::max(std::min(watermark, capacity()), wanted);
+			return (previous < level) && (current >= level);
 		}
 
 
@@ -202,22 +360,41 @@ namespace dyplo
 		T* m_first;
 		T* m_last;
 		unsigned int m_size;
+		unsigned int m_read_watermark;
+		unsigned int m_write_watermark;
+		unsigned int m_read_timeout_us;
+		unsigned int m_read_wanted;
+		unsigned int m_write_wanted;
 	};
 
 	/* Generic case where "new" and "delete" are being used to
-	 * create the buffer */
+	 * create the buffer, or where it is taken from an arena */
 	template <class T, class Scheduler> class FixedMemoryQueue:
 		public FixedMemoryQueueImpl<T, Scheduler>
 	{
 	public:
+		typedef FixedMemoryQueueImpl<T, Scheduler> Base;
+
 		FixedMemoryQueue(unsigned int capacity, const Scheduler& scheduler = Scheduler()):
-			FixedMemoryQueueImpl<T, Scheduler>(new T[capacity], capacity, scheduler)
+			Base(new T[capacity], capacity, scheduler),
+			m_arena(NULL)
+		{
+			RealtimeMemory::prepare(Base::m_buff, capacity * sizeof(T));
+		}
+		FixedMemoryQueue(Arena& arena, unsigned int capacity, const Scheduler& scheduler = Scheduler()):
+			Base(arena.allocate_array<T>(capacity), capacity, scheduler),
+			m_arena(&arena)
 		{
 		}
 		~FixedMemoryQueue()
 		{
-			delete [] FixedMemoryQueueImpl<T, Scheduler>::m_buff;
+			if (m_arena)
+				Arena::destroy_array(Base::m_buff, Base::capacity());
+			else
+				delete [] Base::m_buff;
 		}
+	protected:
+		Arena* m_arena;
 	};
 
 	/* A specialized queue that can only hold one element. */
@@ -302,7 +479,7 @@ namespace dyplo
 		bool empty() const { return !m_full; }
 		bool full() const { return m_full; }
 
-		void push_one(const T data)
+		void push_one(const T& data)
 		{
 			T* buffer;
 			begin_write(buffer, 1);
@@ -310,11 +487,25 @@ namespace dyplo
 			end_write(1);
 		}
 
+#if __cplusplus >= 201103L
+		void push_one(T&& data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = std::move(data);
+			end_write(1);
+		}
+#endif
+
 		T pop_one()
 		{
 			T* buffer;
 			begin_read(buffer, 1);
+#if __cplusplus >= 201103L
+			T result(std::move(*buffer));
+#else
 			T result = *buffer;
+#endif
 			end_read(1);
 			return result;
 		}
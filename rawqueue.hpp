@@ -0,0 +1,123 @@
+/*
+ * rawqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+/* Requires C++11 */
+#include <new>
+#include <utility>
+#include "queue.hpp"
+
+namespace dyplo
+{
+	/* FixedMemoryQueue that does not construct its elements up front.
+	 * Elements are constructed in place when written, moved out and
+	 * destroyed when read, so elements like std::string pass through
+	 * without copies or extra allocations.
+	 * When using begin_write directly, the writer must construct the
+	 * elements in the returned memory (placement new) before calling
+	 * end_write. end_read destroys the elements it consumes. */
+	template <class T, class Scheduler> class RawMemoryQueue:
+		public FixedMemoryQueueImpl<T, Scheduler>
+	{
+	public:
+		typedef FixedMemoryQueueImpl<T, Scheduler> Base;
+
+		RawMemoryQueue(unsigned int capacity, const Scheduler& scheduler = Scheduler()):
+			Base(static_cast<T*>(::operator new(capacity * sizeof(T))), capacity, scheduler),
+			m_arena(NULL)
+		{
+			RealtimeMemory::prepare(Base::m_buff, capacity * sizeof(T));
+		}
+
+		RawMemoryQueue(Arena& arena, unsigned int capacity, const Scheduler& scheduler = Scheduler()):
+			Base(static_cast<T*>(arena.allocate(capacity * sizeof(T))), capacity, scheduler),
+			m_arena(&arena)
+		{
+		}
+
+		~RawMemoryQueue()
+		{
+			destroy_all();
+			if (!m_arena)
+				::operator delete(Base::m_buff);
+		}
+
+		void clear()
+		{
+			ScopedLock<Scheduler> lock(Base::m_scheduler);
+			destroy_all();
+			Base::m_first = Base::m_buff;
+			Base::m_last = Base::m_buff;
+			Base::m_size = 0;
+		}
+
+		/* Destroys the consumed elements */
+		void end_read(unsigned int count)
+		{
+			T* element = Base::m_last;
+			for (unsigned int i = 0; i < count; ++i)
+				(element++)->~T();
+			Base::end_read(count);
+		}
+
+		/* Construct an element in the queue from the arguments */
+		template <class... Args> void emplace(Args&&... args)
+		{
+			T* buffer;
+			Base::begin_write(buffer, 1);
+			new (buffer) T(std::forward<Args>(args)...);
+			Base::end_write(1);
+		}
+
+		void push_one(const T& data) { emplace(data); }
+		void push_one(T&& data) { emplace(std::move(data)); }
+
+		T pop_one()
+		{
+			T* buffer;
+			Base::begin_read(buffer, 1);
+			T result(std::move(*buffer));
+			end_read(1);
+			return result;
+		}
+	protected:
+		void destroy_all()
+		{
+			T* element = Base::m_last;
+			for (unsigned int i = 0; i < Base::m_size; ++i)
+			{
+				element->~T();
+				if (++element == Base::m_end)
+					element = Base::m_buff;
+			}
+		}
+
+		Arena* m_arena;
+	};
+}
@@ -0,0 +1,164 @@
+/*
+ * reactor.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include "reactor.hpp"
+#include "exceptions.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace dyplo
+{
+	static const unsigned int MAX_EVENTS = 16;
+
+	Reactor::Reactor():
+		m_epoll(::epoll_create1(EPOLL_CLOEXEC)),
+		m_wakeup(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+		m_running(false)
+	{
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = m_wakeup;
+		if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev) != 0)
+			throw IOException("epoll_ctl");
+	}
+
+	void Reactor::add(int handle, unsigned int events, ReactorHandler* handler)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = handle;
+		if (::epoll_ctl(m_epoll, EPOLL_CTL_ADD, handle, &ev) != 0)
+			throw IOException("epoll_ctl");
+		m_handlers[handle] = handler;
+	}
+
+	void Reactor::modify(int handle, unsigned int events)
+	{
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.fd = handle;
+		if (::epoll_ctl(m_epoll, EPOLL_CTL_MOD, handle, &ev) != 0)
+			throw IOException("epoll_ctl");
+	}
+
+	void Reactor::remove(int handle)
+	{
+		::epoll_ctl(m_epoll, EPOLL_CTL_DEL, handle, NULL);
+		m_handlers.erase(handle);
+	}
+
+	unsigned int Reactor::poll(int timeout_ms)
+	{
+		struct epoll_event events[MAX_EVENTS];
+		int count = ::epoll_wait(m_epoll, events, MAX_EVENTS, timeout_ms);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				return 0;
+			throw IOException("epoll_wait");
+		}
+		unsigned int result = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			int handle = events[i].data.fd;
+			if (handle == m_wakeup)
+			{
+				uint64_t value;
+				if (::read(m_wakeup, &value, sizeof(value)) > 0)
+					m_running = false;
+				continue;
+			}
+			/* Handler may have been removed by a previous one */
+			std::map<int, ReactorHandler*>::iterator it = m_handlers.find(handle);
+			if (it == m_handlers.end())
+				continue;
+			it->second->ready(events[i].events);
+			++result;
+		}
+		return result;
+	}
+
+	void Reactor::run()
+	{
+		m_running = true;
+		while (m_running)
+			poll(-1);
+	}
+
+	void Reactor::stop()
+	{
+		uint64_t value = 1;
+		if (::write(m_wakeup, &value, sizeof(value)) < 0)
+			throw IOException("eventfd");
+	}
+
+
+	ReactorTimer::ReactorTimer(Reactor& reactor):
+		m_reactor(reactor),
+		m_timer(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK))
+	{
+		m_reactor.add(m_timer, EPOLLIN, this);
+	}
+
+	ReactorTimer::~ReactorTimer()
+	{
+		m_reactor.remove(m_timer);
+	}
+
+	void ReactorTimer::start(unsigned int initial_us, unsigned int interval_us)
+	{
+		struct itimerspec spec;
+		spec.it_value.tv_sec = initial_us / 1000000;
+		spec.it_value.tv_nsec = (initial_us % 1000000) * 1000;
+		/* Zero would disarm the timer */
+		if (initial_us == 0)
+			spec.it_value.tv_nsec = 1;
+		spec.it_interval.tv_sec = interval_us / 1000000;
+		spec.it_interval.tv_nsec = (interval_us % 1000000) * 1000;
+		if (::timerfd_settime(m_timer, 0, &spec, NULL) != 0)
+			throw IOException("timerfd_settime");
+	}
+
+	void ReactorTimer::stop()
+	{
+		struct itimerspec spec = {{0, 0}, {0, 0}};
+		if (::timerfd_settime(m_timer, 0, &spec, NULL) != 0)
+			throw IOException("timerfd_settime");
+	}
+
+	void ReactorTimer::ready(unsigned int /*events*/)
+	{
+		uint64_t count;
+		if (::read(m_timer, &count, sizeof(count)) != sizeof(count))
+			return; /* Stopped or restarted in the meantime */
+		expired((unsigned int)count);
+	}
+}
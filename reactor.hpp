@@ -0,0 +1,175 @@
+/*
+ * reactor.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <map>
+#include <sys/epoll.h>
+#include "fileio.hpp"
+#include "hardware.hpp"
+
+namespace dyplo
+{
+	class ReactorHandler
+	{
+	public:
+		virtual ~ReactorHandler() {}
+		/* Called from Reactor::poll with the EPOLLIN/EPOLLOUT/...
+		 * flags that are active for the handle. */
+		virtual void ready(unsigned int events) = 0;
+	};
+
+	/* Waits for events on many file handles in a single thread using
+	 * epoll, and calls the registered handler for each handle that
+	 * became ready. Handles are level-triggered, so a handler must
+	 * either consume the event or change its registration. */
+	class Reactor
+	{
+	public:
+		Reactor();
+
+		/* Register handle, events is a combination of EPOLLIN and
+		 * EPOLLOUT. May be called from within a handler. */
+		void add(int handle, unsigned int events, ReactorHandler* handler);
+		/* Change the events to wait for. Pass 0 to disable the
+		 * handle without removing it. */
+		void modify(int handle, unsigned int events);
+		/* Unregister handle. Pending events for it are discarded, so it
+		 * is safe to remove (and delete) any handler from within a
+		 * handler. */
+		void remove(int handle);
+
+		/* Wait at most timeout_ms (-1 is forever) and dispatch events.
+		 * Returns the number of handlers that were called. */
+		unsigned int poll(int timeout_ms);
+		/* Call poll until stop is called */
+		void run();
+		/* Make run return. Can be called from any thread. */
+		void stop();
+	protected:
+		File m_epoll;
+		File m_wakeup;
+		bool m_running;
+		std::map<int, ReactorHandler*> m_handlers;
+	};
+
+	/* Periodic or single-shot timer that runs in the reactor thread */
+	class ReactorTimer: public ReactorHandler
+	{
+	public:
+		ReactorTimer(Reactor& reactor);
+		~ReactorTimer();
+		/* Start the timer, first expiry after initial_us, then every
+		 * interval_us. Interval 0 makes it a single-shot timer. */
+		void start(unsigned int initial_us, unsigned int interval_us = 0);
+		void stop();
+		/* Called with the number of expirations since the last call,
+		 * which is more than 1 when the reactor thread was late. */
+		virtual void expired(unsigned int count) = 0;
+
+		virtual void ready(unsigned int events);
+	protected:
+		Reactor& m_reactor;
+		File m_timer;
+	};
+
+	/* Services a DMA node from a reactor. Blocks go to the logic through
+	 * enqueue, and come back through "completed": for reading a block
+	 * filled with data, for writing a block that has been sent and can
+	 * be filled again. Only blocks enqueued through this handler are
+	 * waited for, the node is disabled in the reactor when none are
+	 * pending. The fifo is switched to non-blocking mode. */
+	template <class DMAFifo = HardwareDMAFifo> class DMACompletionHandler: public ReactorHandler
+	{
+	public:
+		typedef typename DMAFifo::Block Block;
+
+		DMACompletionHandler(Reactor& reactor, DMAFifo& fifo, bool direction_from_logic):
+			m_reactor(reactor),
+			m_fifo(fifo),
+			m_events(direction_from_logic ? EPOLLIN : EPOLLOUT),
+			m_pending(0)
+		{
+			if (set_non_blocking(m_fifo) != 0)
+				throw IOException();
+			m_reactor.add(m_fifo, 0, this);
+		}
+
+		~DMACompletionHandler()
+		{
+			m_reactor.remove(m_fifo);
+		}
+
+		/* Take all blocks out of the fifo. For reading, they are handed
+		 * to the logic, for writing each is passed to "completed" so
+		 * it can be filled. Call once after configuring the fifo. */
+		void start()
+		{
+			for (unsigned int i = m_fifo.count(); i != 0; --i)
+			{
+				Block* block = m_fifo.dequeue();
+				if (m_events == EPOLLIN)
+				{
+					block->bytes_used = block->size;
+					enqueue(block);
+				}
+				else
+					completed(block);
+			}
+		}
+
+		void enqueue(Block* block)
+		{
+			m_fifo.enqueue(block);
+			if (m_pending++ == 0)
+				m_reactor.modify(m_fifo, m_events);
+		}
+
+		unsigned int pending() const { return m_pending; }
+
+		virtual void completed(Block* block) = 0;
+
+		virtual void ready(unsigned int /*events*/)
+		{
+			while (m_pending)
+			{
+				Block* block = m_fifo.dequeue();
+				if (!block)
+					return;
+				if (--m_pending == 0)
+					m_reactor.modify(m_fifo, 0);
+				completed(block);
+			}
+		}
+	protected:
+		Reactor& m_reactor;
+		DMAFifo& m_fifo;
+		unsigned int m_events;
+		unsigned int m_pending;
+	};
+}
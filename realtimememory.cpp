@@ -0,0 +1,121 @@
+/*
+ * realtimememory.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include <alloca.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include "realtimememory.hpp"
+#include "exceptions.hpp"
+
+namespace dyplo
+{
+	static bool realtime_enabled = false;
+	static size_t realtime_stack_reserve;
+	static size_t realtime_locked;
+
+	void RealtimeMemory::enable(size_t stack_reserve)
+	{
+		realtime_stack_reserve = stack_reserve;
+		__atomic_store_n(&realtime_enabled, true, __ATOMIC_RELEASE);
+	}
+
+	void RealtimeMemory::disable()
+	{
+		__atomic_store_n(&realtime_enabled, false, __ATOMIC_RELEASE);
+	}
+
+	bool RealtimeMemory::enabled()
+	{
+		return __atomic_load_n(&realtime_enabled, __ATOMIC_ACQUIRE);
+	}
+
+	void RealtimeMemory::lock_all()
+	{
+		if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+			throw IOException("mlockall");
+	}
+
+	size_t RealtimeMemory::prepare(const void* data, size_t size)
+	{
+		if (!size || !enabled())
+			return 0;
+		const uintptr_t page_size = ::sysconf(_SC_PAGESIZE);
+		const uintptr_t begin = ((uintptr_t)data) & ~(page_size - 1);
+		const uintptr_t end = ((uintptr_t)data + size + page_size - 1) & ~(page_size - 1);
+		/* Locking faults in private memory, but not all device
+		 * mappings, so touch every page as well. */
+		(void)*(volatile const char*)data;
+		for (uintptr_t page = begin + page_size; page < end; page += page_size)
+			(void)*(volatile const char*)page;
+		if (::mlock((const void*)begin, end - begin) != 0)
+			throw IOException("mlock");
+		__atomic_add_fetch(&realtime_locked, end - begin, __ATOMIC_RELAXED);
+		return end - begin;
+	}
+
+	/* Room left on the stack for the calling thread's own use */
+	static const size_t stack_margin = 16 * 1024;
+
+	size_t RealtimeMemory::prepare_thread()
+	{
+		if (!enabled() || !realtime_stack_reserve)
+			return 0;
+		/* Never reserve more than the stack has left below here */
+		pthread_attr_t attr;
+		if (::pthread_getattr_np(::pthread_self(), &attr) != 0)
+			return 0;
+		void* stack_address;
+		size_t stack_size;
+		const int result = ::pthread_attr_getstack(&attr, &stack_address, &stack_size);
+		::pthread_attr_destroy(&attr);
+		if (result != 0)
+			return 0;
+		char here;
+		const size_t left = &here - (char*)stack_address;
+		if (left <= stack_margin)
+			return 0;
+		const size_t reserve = std::min(realtime_stack_reserve, left - stack_margin);
+		/* Grow the stack by writing to it from the top down, so the
+		 * guard page is never skipped. It stays mapped after
+		 * returning from here. */
+		volatile char* stack = (volatile char*)alloca(reserve);
+		const size_t page_size = ::sysconf(_SC_PAGESIZE);
+		for (size_t offset = reserve; offset > page_size; offset -= page_size)
+			stack[offset - 1] = 0;
+		stack[0] = 0;
+		return prepare((const void*)stack, reserve);
+	}
+
+	size_t RealtimeMemory::locked()
+	{
+		return __atomic_load_n(&realtime_locked, __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * realtimememory.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <stddef.h>
+
+namespace dyplo
+{
+	/* Opt-in mode that avoids page faults once a pipeline is running.
+	 * When enabled, queue buffers, arenas and DMA blocks are faulted in
+	 * and locked into RAM as they are created, and threaded processes
+	 * fault in and lock part of their stack before they start
+	 * processing. Enable it before setting up the pipeline. Locking
+	 * needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK, prepare
+	 * throws IOException when it fails. */
+	class RealtimeMemory
+	{
+	public:
+		static void enable(size_t stack_reserve = 64 * 1024);
+		static void disable();
+		static bool enabled();
+
+		/* Also lock everything mapped now or later into this process,
+		 * using mlockall. */
+		static void lock_all();
+
+		/* Fault in and lock the range when enabled. Returns the number
+		 * of bytes locked, whole pages. */
+		static size_t prepare(const void* data, size_t size);
+		/* Same, for the stack of the calling thread. Takes at most the
+		 * stack_reserve passed to enable, limited to what the thread's
+		 * stack has left minus a safety margin. */
+		static size_t prepare_thread();
+
+		/* Cumulative number of bytes locked by prepare. It does not go
+		 * down when memory is freed, and a page shared by several
+		 * buffers counts once for each. */
+		static size_t locked();
+	};
+}
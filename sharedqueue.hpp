@@ -0,0 +1,292 @@
+/*
+ * sharedqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <algorithm>
+#include <stdexcept>
+#include "exceptions.hpp"
+#include "fileio.hpp"
+#include "realtimememory.hpp"
+
+namespace dyplo
+{
+	/* Queue between two processes, one writer and one reader. The ring
+	 * and its counters live in a memfd that both processes map, so
+	 * elements are not copied from one to the other. Readers and
+	 * writers sleep on futexes in the shared memory when the queue is
+	 * empty or full. The creating process passes handle() to the other
+	 * process, through fork or a unix socket, which then attaches
+	 * with the file descriptor constructor.
+	 * Elements are shared as plain memory, so T must not contain
+	 * pointers or otherwise depend on its address space.
+	 * The capacity is rounded up to a power of two, so that the ring
+	 * index stays continuous when the positions wrap around. */
+	template <class T> class SharedMemoryQueue
+	{
+	public:
+		typedef T Element;
+
+		/* Create a new queue */
+		SharedMemoryQueue(unsigned int capacity):
+			m_file(::memfd_create("dyplo-queue", MFD_CLOEXEC)),
+			m_interrupted_read(false),
+			m_interrupted_write(false)
+		{
+			if (!capacity)
+				throw std::invalid_argument("SharedMemoryQueue capacity is 0");
+			capacity = round_up(capacity);
+			if (::ftruncate(m_file, bytes(capacity)) != 0)
+				throw IOException("ftruncate");
+			map(bytes(capacity));
+			m_control->magic = magic;
+			m_control->element_size = sizeof(T);
+			m_control->capacity = capacity;
+			m_control->written = 0;
+			m_control->read = 0;
+			m_control->reader.waiting = 0;
+			m_control->reader.event = 0;
+			m_control->writer.waiting = 0;
+			m_control->writer.event = 0;
+		}
+
+		/* Attach to a queue created elsewhere. Duplicates the handle,
+		 * so the caller keeps ownership of "segment". */
+		explicit SharedMemoryQueue(const File& segment):
+			m_file(segment),
+			m_interrupted_read(false),
+			m_interrupted_write(false)
+		{
+			off_t size = m_file.seek(0, SEEK_END);
+			if (size < (off_t)sizeof(Control))
+				throw std::runtime_error("Not a SharedMemoryQueue");
+			map(size);
+			if ((m_control->magic != magic) ||
+				(m_control->element_size != sizeof(T)) ||
+				!m_control->capacity ||
+				(m_control->capacity & (m_control->capacity - 1)) ||
+				(bytes(m_control->capacity) != (size_t)size))
+			{
+				::munmap(m_control, size);
+				throw std::runtime_error("Not a SharedMemoryQueue of this type");
+			}
+		}
+
+		~SharedMemoryQueue()
+		{
+			::munmap(m_control, bytes(m_control->capacity));
+		}
+
+		/* Pass this to the other process */
+		int handle() const { return m_file; }
+
+		unsigned int begin_write(T* &buffer, unsigned int count_min)
+		{
+			for (;;)
+			{
+				const uint32_t read = __atomic_load_n(&m_control->read, __ATOMIC_ACQUIRE);
+				if (available(read) >= count_min)
+				{
+					const uint32_t index = m_control->written & (capacity() - 1);
+					buffer = m_data + index;
+					return std::min(available(read), capacity() - index);
+				}
+				wait(m_control->writer, m_control->read, read, m_interrupted_write);
+			}
+		}
+
+		void end_write(unsigned int count)
+		{
+			__atomic_store_n(&m_control->written, m_control->written + count, __ATOMIC_RELEASE);
+			wake(m_control->reader);
+		}
+
+		unsigned int begin_read(T* &buffer, unsigned int count_min)
+		{
+			for (;;)
+			{
+				const uint32_t written = __atomic_load_n(&m_control->written, __ATOMIC_ACQUIRE);
+				const uint32_t count = written - m_control->read;
+				if (count >= count_min)
+				{
+					const uint32_t index = m_control->read & (capacity() - 1);
+					buffer = m_data + index;
+					return std::min(count, capacity() - index);
+				}
+				wait(m_control->reader, m_control->written, written, m_interrupted_read);
+			}
+		}
+
+		void end_read(unsigned int count)
+		{
+			__atomic_store_n(&m_control->read, m_control->read + count, __ATOMIC_RELEASE);
+			wake(m_control->writer);
+		}
+
+		void push_one(const T& data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = data;
+			end_write(1);
+		}
+
+		T pop_one()
+		{
+			T* buffer;
+			begin_read(buffer, 1);
+			T result = *buffer;
+			end_read(1);
+			return result;
+		}
+
+		unsigned int capacity() const { return m_control->capacity; }
+		unsigned int size() const
+		{
+			return __atomic_load_n(&m_control->written, __ATOMIC_ACQUIRE) -
+				__atomic_load_n(&m_control->read, __ATOMIC_ACQUIRE);
+		}
+		bool empty() const { return size() == 0; }
+
+		/* Interrupt waiting in this process only */
+		void interrupt_read()
+		{
+			__atomic_store_n(&m_interrupted_read, true, __ATOMIC_SEQ_CST);
+			signal(m_control->reader);
+		}
+		void interrupt_write()
+		{
+			__atomic_store_n(&m_interrupted_write, true, __ATOMIC_SEQ_CST);
+			signal(m_control->writer);
+		}
+		void resume_read() { __atomic_store_n(&m_interrupted_read, false, __ATOMIC_SEQ_CST); }
+		void resume_write() { __atomic_store_n(&m_interrupted_write, false, __ATOMIC_SEQ_CST); }
+	protected:
+		static const uint32_t magic = 0x44595153; /* "DYQS" */
+
+		/* Where one side sleeps. The event counter is the futex, it
+		 * changes whenever the sleeper has to look again. */
+		struct Sleeper
+		{
+			uint32_t waiting;
+			uint32_t event;
+		};
+
+		/* Shared between the processes. The positions run freely and
+		 * wrap at 2^32. */
+		struct Control
+		{
+			uint32_t magic;
+			uint32_t element_size;
+			uint32_t capacity;
+			uint32_t padding0[13];
+			uint32_t written; /* Separate cache lines */
+			Sleeper reader;
+			uint32_t padding1[13];
+			uint32_t read;
+			Sleeper writer;
+			uint32_t padding2[13];
+		};
+
+		static unsigned int round_up(unsigned int value)
+		{
+			unsigned int result = 1;
+			while (result < value)
+				result <<= 1;
+			return result;
+		}
+
+		static size_t bytes(unsigned int capacity)
+		{
+			return sizeof(Control) + capacity * sizeof(T);
+		}
+
+		void map(size_t size)
+		{
+			void* memory = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+			if (memory == MAP_FAILED)
+				throw IOException("mmap");
+			RealtimeMemory::prepare(memory, size);
+			m_control = (Control*)memory;
+			m_data = (T*)(m_control + 1);
+		}
+
+		uint32_t available(uint32_t read) const
+		{
+			return capacity() - (m_control->written - read);
+		}
+
+		/* Sleep until the other side moves "position" away from
+		 * "seen", or until interrupted. The event is sampled before
+		 * announcing, so a wake-up in between makes the futex call
+		 * return immediately instead of getting lost. */
+		static void wait(Sleeper& sleeper, const uint32_t& position, uint32_t seen, const bool& interrupted)
+		{
+			const uint32_t event = __atomic_load_n(&sleeper.event, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&sleeper.waiting, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&interrupted, __ATOMIC_SEQ_CST))
+				throw InterruptedException();
+			if (__atomic_load_n(&position, __ATOMIC_SEQ_CST) != seen)
+				return;
+			if (::syscall(SYS_futex, &sleeper.event, FUTEX_WAIT, event, NULL, NULL, 0) != 0)
+			{
+				if ((errno != EAGAIN) && (errno != EINTR))
+					throw IOException("futex");
+			}
+		}
+
+		/* Only enter the kernel when the other side sleeps */
+		static void wake(Sleeper& sleeper)
+		{
+			if (__atomic_exchange_n(&sleeper.waiting, 0, __ATOMIC_SEQ_CST))
+				signal(sleeper);
+		}
+
+		static void signal(Sleeper& sleeper)
+		{
+			__atomic_add_fetch(&sleeper.event, 1, __ATOMIC_SEQ_CST);
+			::syscall(SYS_futex, &sleeper.event, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		}
+
+		File m_file;
+		Control* m_control;
+		T* m_data;
+		bool m_interrupted_read;
+		bool m_interrupted_write;
+	private:
+		SharedMemoryQueue(const SharedMemoryQueue&);
+		SharedMemoryQueue& operator=(const SharedMemoryQueue&);
+	};
+}
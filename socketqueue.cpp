@@ -0,0 +1,181 @@
+/*
+ * socketqueue.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include "socketqueue.hpp"
+
+namespace dyplo
+{
+	static void set_no_delay(int handle)
+	{
+		int value = 1;
+		/* Fails for unix sockets, which don't need it */
+		::setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+	}
+
+	/* Try each address for host:port until one binds or connects */
+	static int inet_socket(const char* host, unsigned short port, int type, bool listening)
+	{
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = type;
+		hints.ai_flags = listening ? AI_PASSIVE : 0;
+		char service[8];
+		snprintf(service, sizeof(service), "%u", port);
+		struct addrinfo* addresses;
+		int error = ::getaddrinfo(host, service, &hints, &addresses);
+		if (error != 0)
+			throw std::runtime_error(::gai_strerror(error));
+		int saved_errno = EADDRNOTAVAIL;
+		int handle = -1;
+		for (struct addrinfo* address = addresses; address != NULL; address = address->ai_next)
+		{
+			handle = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+			if (handle == -1)
+			{
+				saved_errno = errno;
+				continue;
+			}
+			int result;
+			if (listening)
+			{
+				int value = 1;
+				::setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+				result = ::bind(handle, address->ai_addr, address->ai_addrlen);
+				if ((result == 0) && (type == SOCK_STREAM))
+					result = ::listen(handle, SOMAXCONN);
+			}
+			else
+				result = ::connect(handle, address->ai_addr, address->ai_addrlen);
+			if (result == 0)
+				break;
+			saved_errno = errno;
+			::close(handle);
+			handle = -1;
+		}
+		::freeaddrinfo(addresses);
+		if (handle == -1)
+			throw IOException(listening ? "bind" : "connect", saved_errno);
+		if (type == SOCK_STREAM)
+			set_no_delay(handle);
+		return handle;
+	}
+
+	static int unix_socket(const char* path, bool listening)
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(address.sun_path))
+			throw std::invalid_argument("Socket path too long");
+		strcpy(address.sun_path, path);
+		int handle = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (handle == -1)
+			throw IOException("socket");
+		int result;
+		if (listening)
+		{
+			result = ::bind(handle, (struct sockaddr*)&address, sizeof(address));
+			if (result == 0)
+				result = ::listen(handle, SOMAXCONN);
+		}
+		else
+			result = ::connect(handle, (struct sockaddr*)&address, sizeof(address));
+		if (result != 0)
+		{
+			int saved_errno = errno;
+			::close(handle);
+			throw IOException(path, saved_errno);
+		}
+		return handle;
+	}
+
+	int tcp_listen(unsigned short port, const char* host)
+	{
+		return inet_socket(host, port, SOCK_STREAM, true);
+	}
+
+	int tcp_connect(const char* host, unsigned short port)
+	{
+		return inet_socket(host, port, SOCK_STREAM, false);
+	}
+
+	int unix_listen(const char* path)
+	{
+		return unix_socket(path, true);
+	}
+
+	int unix_connect(const char* path)
+	{
+		return unix_socket(path, false);
+	}
+
+	int socket_accept(int listener)
+	{
+		int handle;
+		do
+		{
+			handle = ::accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		}
+		while ((handle == -1) && (errno == EINTR));
+		if (handle == -1)
+			throw IOException("accept");
+		set_no_delay(handle);
+		return handle;
+	}
+
+	int udp_bind(unsigned short port, const char* host)
+	{
+		return inet_socket(host, port, SOCK_DGRAM, true);
+	}
+
+	int udp_connect(const char* host, unsigned short port)
+	{
+		return inet_socket(host, port, SOCK_DGRAM, false);
+	}
+
+	unsigned short socket_port(int handle)
+	{
+		struct sockaddr_storage address;
+		socklen_t length = sizeof(address);
+		if (::getsockname(handle, (struct sockaddr*)&address, &length) != 0)
+			throw IOException("getsockname");
+		if (address.ss_family == AF_INET)
+			return ntohs(((struct sockaddr_in*)&address)->sin_port);
+		if (address.ss_family == AF_INET6)
+			return ntohs(((struct sockaddr_in6*)&address)->sin6_port);
+		return 0;
+	}
+}
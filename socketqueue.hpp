@@ -0,0 +1,415 @@
+/*
+ * socketqueue.hpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "filequeue.hpp"
+
+namespace dyplo
+{
+	/* Create sockets for the queues below. Each returns a handle that
+	 * the caller owns, and throws IOException on failure. A NULL host
+	 * listens on all addresses. Port 0 picks a free port, use
+	 * socket_port to find out which. TCP sockets have Nagle's
+	 * algorithm disabled, the output queue does its own batching. */
+	int tcp_listen(unsigned short port, const char* host = NULL);
+	int tcp_connect(const char* host, unsigned short port);
+	int unix_listen(const char* path);
+	int unix_connect(const char* path);
+	/* Blocks until a client connects to the listening socket */
+	int socket_accept(int listener);
+	int udp_bind(unsigned short port, const char* host = NULL);
+	int udp_connect(const char* host, unsigned short port);
+	unsigned short socket_port(int handle);
+
+	/* Stream socket reader, reading from a socket is the same as from
+	 * a file or pipe. Throws EndOfInputException when the peer has
+	 * closed the connection. */
+	template <class T> class SocketInputQueue: public FileInputQueue<T>
+	{
+	public:
+		SocketInputQueue(FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			FileInputQueue<T>(scheduler, socket, capacity)
+		{
+		}
+		SocketInputQueue(Arena& arena, FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			FileInputQueue<T>(arena, scheduler, socket, capacity)
+		{
+		}
+	};
+
+	/* Stream socket writer. By default every end_write is sent right
+	 * away. With a larger "batch", elements are collected until that
+	 * many are waiting, and then sent with a single system call. Call
+	 * flush to send a partial batch, for example before waiting for an
+	 * answer, or a low-rate stream may stall. Throws
+	 * EndOfOutputException when the peer has closed the connection. */
+	template <class T> class SocketOutputQueue
+	{
+	public:
+		typedef T Element;
+
+		SocketOutputQueue(FilePollScheduler& scheduler, int socket, unsigned int capacity, unsigned int batch = 1):
+			m_buff(new T[capacity]),
+			m_capacity(capacity),
+			m_batch(batch_size(batch, capacity)),
+			m_used(0),
+			m_sent(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(NULL)
+		{
+			if (set_non_blocking(socket) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+			RealtimeMemory::prepare(m_buff, capacity * sizeof(T));
+		}
+		/* Buffer taken from "arena" */
+		SocketOutputQueue(Arena& arena, FilePollScheduler& scheduler, int socket, unsigned int capacity, unsigned int batch = 1):
+			m_buff(arena.allocate_array<T>(capacity)),
+			m_capacity(capacity),
+			m_batch(batch_size(batch, capacity)),
+			m_used(0),
+			m_sent(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(&arena)
+		{
+			if (set_non_blocking(socket) != 0)
+				throw std::runtime_error("Failed to set non-blocking mode");
+		}
+		~SocketOutputQueue()
+		{
+			if (m_arena)
+				Arena::destroy_array(m_buff, m_capacity);
+			else
+				delete [] m_buff;
+		}
+
+		unsigned int begin_write(T* &buffer, unsigned int count_min)
+		{
+			if (count_min == 0)
+			{
+				/* Don't block, just poll and return */
+				if ((m_used == m_capacity) && send_buffer())
+					return 0;
+			}
+			else
+			{
+				if (count_min > m_capacity)
+					count_min = m_capacity;
+				if (m_capacity - m_used < count_min)
+					send_all();
+			}
+			buffer = m_buff + m_used;
+			return m_capacity - m_used;
+		}
+
+		void end_write(unsigned int count)
+		{
+			m_used += count;
+			if (m_used >= m_batch)
+				send_buffer();
+		}
+
+		void push_one(const T& data)
+		{
+			T* buffer;
+			begin_write(buffer, 1);
+			*buffer = data;
+			end_write(1);
+		}
+
+		/* Block until everything written so far has been sent */
+		void flush()
+		{
+			send_all();
+		}
+
+		/* Elements in the buffer that have not been sent yet */
+		unsigned int size() const { return m_used; }
+
+		void interrupt_write()
+		{
+			m_scheduler.interrupt();
+		}
+
+		FilePollScheduler& get_scheduler() { return m_scheduler; }
+	protected:
+		static unsigned int batch_size(unsigned int batch, unsigned int capacity)
+		{
+			if (batch == 0)
+				return 1;
+			return (batch < capacity) ? batch : capacity;
+		}
+
+		/* Returns whether caller needs to wait for more */
+		bool send_buffer()
+		{
+			while (m_sent < m_used * sizeof(T))
+			{
+				ssize_t result = ::send(m_socket, (char*)m_buff + m_sent,
+						m_used * sizeof(T) - m_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+				if (result < 0)
+				{
+					if (errno == EAGAIN)
+						return true;
+					if (errno == EINTR)
+						continue;
+					if ((errno == EPIPE) || (errno == ECONNRESET))
+						throw EndOfOutputException();
+					throw IOException("send");
+				}
+				m_sent += result;
+			}
+			m_sent = 0;
+			m_used = 0;
+			return false;
+		}
+
+		void send_all()
+		{
+			while (send_buffer())
+				m_scheduler.wait_writeable(m_socket);
+		}
+
+		T* m_buff;
+		unsigned int m_capacity;
+		unsigned int m_batch;
+		unsigned int m_used;
+		unsigned int m_sent; /* bytes */
+		int m_socket;
+		FilePollScheduler& m_scheduler;
+		Arena* m_arena;
+	private:
+		SocketOutputQueue(const SocketOutputQueue&);
+		SocketOutputQueue& operator=(const SocketOutputQueue&);
+	};
+
+	/* Lossy datagram (UDP) writer. Each end_write sends one datagram.
+	 * Never blocks: when the socket cannot take the datagram, or
+	 * nobody listens at the other end, it is dropped and counted. */
+	template <class T> class DatagramOutputQueue
+	{
+	public:
+		typedef T Element;
+
+		DatagramOutputQueue(FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			m_buff(new T[capacity]),
+			m_capacity(capacity),
+			m_dropped(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(NULL)
+		{
+			RealtimeMemory::prepare(m_buff, capacity * sizeof(T));
+		}
+		/* Buffer taken from "arena" */
+		DatagramOutputQueue(Arena& arena, FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			m_buff(arena.allocate_array<T>(capacity)),
+			m_capacity(capacity),
+			m_dropped(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(&arena)
+		{
+		}
+		~DatagramOutputQueue()
+		{
+			if (m_arena)
+				Arena::destroy_array(m_buff, m_capacity);
+			else
+				delete [] m_buff;
+		}
+
+		unsigned int begin_write(T* &buffer, unsigned int /*count_min*/)
+		{
+			buffer = m_buff;
+			return m_capacity;
+		}
+
+		void end_write(unsigned int count)
+		{
+			if (!count)
+				return;
+			if (::send(m_socket, m_buff, count * sizeof(T), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+			{
+				if ((errno != EAGAIN) && (errno != ENOBUFS) && (errno != ECONNREFUSED))
+					throw IOException("send");
+				++m_dropped;
+			}
+		}
+
+		void push_one(const T& data)
+		{
+			*m_buff = data;
+			end_write(1);
+		}
+
+		unsigned int dropped() const { return m_dropped; }
+
+		void interrupt_write()
+		{
+			m_scheduler.interrupt();
+		}
+
+		FilePollScheduler& get_scheduler() { return m_scheduler; }
+	protected:
+		T* m_buff;
+		unsigned int m_capacity;
+		unsigned int m_dropped;
+		int m_socket;
+		FilePollScheduler& m_scheduler;
+		Arena* m_arena;
+	private:
+		DatagramOutputQueue(const DatagramOutputQueue&);
+		DatagramOutputQueue& operator=(const DatagramOutputQueue&);
+	};
+
+	/* Lossy datagram (UDP) reader. Elements of consecutive datagrams
+	 * are appended until count_min elements are available. Datagrams
+	 * that do not fit the capacity or that contain a partial element
+	 * are dropped and counted. */
+	template <class T> class DatagramInputQueue
+	{
+	public:
+		typedef T Element;
+
+		DatagramInputQueue(FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			m_buff(new T[capacity]),
+			m_capacity(capacity),
+			m_size(0),
+			m_dropped(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(NULL)
+		{
+			RealtimeMemory::prepare(m_buff, capacity * sizeof(T));
+		}
+		/* Buffer taken from "arena" */
+		DatagramInputQueue(Arena& arena, FilePollScheduler& scheduler, int socket, unsigned int capacity):
+			m_buff(arena.allocate_array<T>(capacity)),
+			m_capacity(capacity),
+			m_size(0),
+			m_dropped(0),
+			m_socket(socket),
+			m_scheduler(scheduler),
+			m_arena(&arena)
+		{
+		}
+		~DatagramInputQueue()
+		{
+			if (m_arena)
+				Arena::destroy_array(m_buff, m_capacity);
+			else
+				delete [] m_buff;
+		}
+
+		unsigned int begin_read(T* &buffer, unsigned int count_min)
+		{
+			buffer = m_buff;
+			if (count_min > m_capacity)
+				count_min = m_capacity;
+			while ((m_size < count_min) || (count_min == 0))
+			{
+				/* Peek at the size, so that a datagram that does not
+				 * fit behind the current data is not lost. */
+				ssize_t length = ::recv(m_socket, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+				if (length < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					if (errno != EAGAIN)
+						throw IOException("recv");
+					if (count_min == 0)
+						break;
+					m_scheduler.wait_readable(m_socket);
+					continue;
+				}
+				if (((size_t)length > (m_capacity - m_size) * sizeof(T)) && m_size)
+					break; /* Fits in the next call */
+				length = ::recv(m_socket, m_buff + m_size, (m_capacity - m_size) * sizeof(T), MSG_TRUNC | MSG_DONTWAIT);
+				if (length < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					if (errno != EAGAIN)
+						throw IOException("recv");
+					if (count_min == 0)
+						break;
+					m_scheduler.wait_readable(m_socket);
+					continue;
+				}
+				if (((size_t)length > (m_capacity - m_size) * sizeof(T)) || (length % sizeof(T)))
+					++m_dropped;
+				else
+					m_size += length / sizeof(T);
+				if (count_min == 0)
+					break;
+			}
+			return m_size;
+		}
+
+		void end_read(unsigned int count)
+		{
+			m_size -= count;
+			if (m_size)
+				memmove(m_buff, m_buff + count, m_size * sizeof(T));
+		}
+
+		T pop_one()
+		{
+			T* buffer;
+			begin_read(buffer, 1);
+			T result = *buffer;
+			end_read(1);
+			return result;
+		}
+
+		unsigned int dropped() const { return m_dropped; }
+
+		void interrupt_read()
+		{
+			m_scheduler.interrupt();
+		}
+
+		FilePollScheduler& get_scheduler() { return m_scheduler; }
+	protected:
+		T* m_buff;
+		unsigned int m_capacity;
+		unsigned int m_size;
+		unsigned int m_dropped;
+		int m_socket;
+		FilePollScheduler& m_scheduler;
+		Arena* m_arena;
+	private:
+		DatagramInputQueue(const DatagramInputQueue&);
+		DatagramInputQueue& operator=(const DatagramInputQueue&);
+	};
+}
@@ -31,6 +31,8 @@
 #include <vector>
 #include <stdio.h>
 #include "hardware.hpp"
+#include "dmastripe.hpp"
+#include "dmaspin.hpp"
 
 #define YAFFUT_MAIN
 #include "yaffut.h"
@@ -179,6 +181,126 @@ TEST(hardware_driver_ctx, dma_zerocopy_benchmark)
 	std::cout << " (MB/s) ";
 }
 
+TEST(hardware_driver_ctx, dma_striped_benchmark)
+{
+	static const unsigned int max_nodes = 4;
+	static const unsigned int num_blocks = 4;
+	static const unsigned int blocksize = 64*1024;
+	std::vector<dyplo::HardwareDMAFifo*> readers;
+	std::vector<dyplo::HardwareDMAFifo*> writers;
+	for (unsigned int index = 0; index < max_nodes; ++index)
+	{
+		int handle = context.openDMA(index, O_RDONLY);
+		if (handle == -1)
+			break;
+		readers.push_back(new dyplo::HardwareDMAFifo(handle));
+		writers.push_back(new dyplo::HardwareDMAFifo(context.openDMA(index, O_RDWR)));
+		readers.back()->reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, true);
+		writers.back()->reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, false);
+		readers.back()->addRouteFrom(writers.back()->getNodeAndFifoIndex());
+	}
+	for (unsigned int nodes = 1; nodes <= readers.size(); ++nodes)
+	{
+		std::cout << ' ' << nodes << ':';
+		std::vector<dyplo::HardwareDMAFifo*> r(readers.begin(), readers.begin() + nodes);
+		std::vector<dyplo::HardwareDMAFifo*> w(writers.begin(), writers.begin() + nodes);
+		dyplo::StripedDMAChannel<> reader(r, true);
+		dyplo::StripedDMAChannel<> writer(w, false);
+		dyplo::HardwareDMAFifo::Block *block;
+		reader.prime();
+		Stopwatch timer;
+		timer.start();
+		for (unsigned int i = 0 ; i < writer.count(); ++i)
+		{
+			block = writer.dequeue();
+			block->bytes_used = block->size;
+			writer.enqueue(block);
+		}
+		unsigned int total_received = 0;
+		do
+		{
+			for (unsigned int i = (32*1024*1024)/blocksize; i != 0; --i)
+			{
+				block = writer.dequeue();
+				block->bytes_used = block->size;
+				writer.enqueue(block);
+				block = reader.dequeue();
+				total_received += block->bytes_used;
+				block->bytes_used = block->size;
+				reader.enqueue(block);
+			}
+			timer.stop();
+		} while (timer.elapsed_us() < 500000);
+		for (unsigned int i = 0 ; i < writer.count(); ++i)
+		{
+			block = reader.dequeue();
+			total_received += block->bytes_used;
+		}
+		timer.stop();
+		std::cout << (total_received/timer.elapsed_us()) << std::flush;
+		/* The remaining blocks must be handed to the logic again */
+		for (unsigned int i = 0; i < nodes; ++i)
+		{
+			readers[i]->reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, true);
+			writers[i]->reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, false);
+		}
+	}
+	std::cout << " (MB/s per node count) ";
+	for (unsigned int i = 0; i < readers.size(); ++i)
+	{
+		delete readers[i];
+		delete writers[i];
+	}
+}
+
+TEST(hardware_driver_ctx, dma_wakeup_latency_benchmark)
+{
+	static const int dma_index = 0;
+	static const unsigned int num_blocks = 2;
+	static const unsigned int blocksize = 4096;
+	static const unsigned int iterations = 1000;
+	static const unsigned int spin_counts[] = {0, 100, 10000, 1000000};
+	std::cout << "\n round trip (avg/max us) spin";
+	for (unsigned int index = 0; index < sizeof(spin_counts)/sizeof(spin_counts[0]); ++index)
+	{
+		std::cout << ' ' << spin_counts[index] << ':';
+		dyplo::HardwareDMAFifo dma0r(context.openDMA(dma_index, O_RDONLY));
+		dma0r.reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, true);
+		dyplo::HardwareDMAFifo dma0w(context.openDMA(dma_index, O_RDWR));
+		dma0w.reconfigure(dyplo::HardwareDMAFifo::MODE_COHERENT, blocksize, num_blocks, false);
+		dma0r.addRouteFrom(dma0w.getNodeAndFifoIndex());
+		dyplo::SpinningDMAFifo<> reader(dma0r, true, spin_counts[index]);
+		dyplo::HardwareDMAFifo::Block *block;
+		for (unsigned int i = 0; i < num_blocks; ++i)
+		{
+			block = reader.dequeue();
+			block->bytes_used = block->size;
+			reader.enqueue(block);
+		}
+		reader.reset_statistics();
+		unsigned int total_us = 0;
+		unsigned int max_us = 0;
+		Stopwatch timer;
+		for (unsigned int i = 0; i < iterations; ++i)
+		{
+			timer.start();
+			block = dma0w.dequeue();
+			block->bytes_used = block->size;
+			dma0w.enqueue(block);
+			block = reader.dequeue();
+			timer.stop();
+			EQUAL(blocksize, block->bytes_used);
+			reader.enqueue(block);
+			unsigned int elapsed = timer.elapsed_us();
+			total_us += elapsed;
+			if (elapsed > max_us)
+				max_us = elapsed;
+		}
+		std::cout << (total_us / iterations) << '/' << max_us
+			<< " (" << reader.statistics().blocked << " blocked)" << std::flush;
+	}
+}
+
 TEST(hardware_driver_ctx, dma_bounce_benchmark)
 {
 	static const unsigned int max_blocksize_index = 5; /* don't go over 64k */
@@ -26,10 +26,12 @@
  * You can contact Topic by electronic mail via info@topic.nl or via
  * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
  */
+#include <vector>
 #include "queue.hpp"
 #include "noopscheduler.hpp"
 #include "cooperativescheduler.hpp"
 #include "cooperativeprocess.hpp"
+#include "graphscheduler.hpp"
 
 #include "yaffut.h"
 
@@ -48,6 +50,14 @@ class AddOne: public dyplo::CooperativeProcess<
 {
 };
 
+static unsigned int process_add_one_calls;
+template <class TD, class TS> void process_add_one(TD* dest, TS* src, unsigned int count)
+{
+	++process_add_one_calls;
+	for (unsigned int i = 0; i < count; ++i)
+		*dest++ = (*src++) + 1;
+}
+
 struct cooperative_scheduler {};
 
 TEST(cooperative_scheduler, single_element_queue)
@@ -124,3 +134,247 @@ TEST(cooperative_scheduler, multiple_processes_and_queues)
 	input_to_a.push_one(61);
 	YAFFUT_EQUAL(2u, output_from_b.size());
 }
+
+TEST(cooperative_scheduler, dynamic_process)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::CooperativeScheduler> input(8);
+	dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> output(8);
+
+	dyplo::CooperativeDynamicProcess<typeof(input), typeof(output),
+		process_add_one<int, int> > proc;
+	proc.set_input(&input);
+	proc.set_output(&output);
+
+	process_add_one_calls = 0;
+	int* data;
+	YAFFUT_EQUAL(8u, input.begin_write(data, 5));
+	for (int i = 0; i < 5; ++i)
+		data[i] = 10 * i;
+	input.end_write(5);
+	/* All five in a single call */
+	YAFFUT_EQUAL(1u, process_add_one_calls);
+	YAFFUT_CHECK(input.empty());
+	YAFFUT_EQUAL(5u, output.size());
+	for (int i = 0; i < 5; ++i)
+		YAFFUT_EQUAL(10 * i + 1, output.pop_one());
+	input.push_one(7);
+	YAFFUT_EQUAL(2u, process_add_one_calls);
+	YAFFUT_EQUAL(8, output.pop_one());
+}
+
+static std::vector<int> stage_log;
+template <int stage> void logged_add_one(int* dest, int* src)
+{
+	stage_log.push_back(stage);
+	*dest = *src + 1;
+}
+
+template <class Scheduler> static void run_logged_chain()
+{
+	typedef dyplo::FixedMemoryQueue<int, Scheduler> Queue;
+	Queue input_to_a(4);
+	Queue between_a_and_b(4);
+	dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> output_from_b(4);
+	dyplo::CooperativeProcess<Queue, Queue, logged_add_one<1> > a;
+	dyplo::CooperativeProcess<Queue, typeof(output_from_b), logged_add_one<2> > b;
+	a.set_input(&input_to_a);
+	a.set_output(&between_a_and_b);
+	b.set_input(&between_a_and_b);
+	b.set_output(&output_from_b);
+
+	stage_log.clear();
+	int* data;
+	input_to_a.begin_write(data, 3);
+	data[0] = 1;
+	data[1] = 2;
+	data[2] = 3;
+	input_to_a.end_write(3);
+	for (int i = 1; i <= 3; ++i)
+		YAFFUT_EQUAL(i + 2, output_from_b.pop_one());
+}
+
+TEST(cooperative_scheduler, trampoline_runs_batches)
+{
+	/* The cooperative scheduler passes each element down the chain */
+	run_logged_chain<dyplo::CooperativeScheduler>();
+	YAFFUT_EQUAL(6u, stage_log.size());
+	YAFFUT_EQUAL(1, stage_log[0]);
+	YAFFUT_EQUAL(2, stage_log[1]);
+	YAFFUT_EQUAL(1, stage_log[2]);
+	/* The trampoline finishes each stage first */
+	run_logged_chain<dyplo::TrampolineScheduler>();
+	YAFFUT_EQUAL(6u, stage_log.size());
+	YAFFUT_EQUAL(1, stage_log[0]);
+	YAFFUT_EQUAL(1, stage_log[1]);
+	YAFFUT_EQUAL(1, stage_log[2]);
+	YAFFUT_EQUAL(2, stage_log[3]);
+	YAFFUT_EQUAL(2, stage_log[5]);
+}
+
+TEST(cooperative_scheduler, trampoline_long_chain)
+{
+	/* The stack depth does not depend on the length of the chain */
+	const unsigned int stages = 20000;
+	typedef dyplo::FixedMemoryQueue<int, dyplo::TrampolineScheduler> Queue;
+	std::vector<Queue*> queues;
+	for (unsigned int i = 0; i <= stages; ++i)
+		queues.push_back(new Queue(2));
+	{
+		std::vector<AddOne<Queue, Queue> > processes(stages);
+		dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> output(2);
+		AddOne<Queue, typeof(output)> last;
+		for (unsigned int i = 0; i < stages; ++i)
+		{
+			processes[i].set_input(queues[i]);
+			processes[i].set_output(queues[i + 1]);
+		}
+		last.set_input(queues[stages]);
+		last.set_output(&output);
+
+		queues[0]->push_one(1);
+		YAFFUT_EQUAL((int)stages + 2, output.pop_one());
+		queues[0]->push_one(2);
+		queues[0]->push_one(3);
+		YAFFUT_EQUAL((int)stages + 3, output.pop_one());
+		YAFFUT_EQUAL((int)stages + 4, output.pop_one());
+	}
+	for (unsigned int i = 0; i <= stages; ++i)
+		delete queues[i];
+}
+
+typedef dyplo::FixedMemoryQueue<int, dyplo::GraphScheduler> GraphQueue;
+
+class CountingSource: public dyplo::GraphProcess
+{
+public:
+	CountingSource(GraphQueue& output, int first, int count):
+		m_output(output), m_next(first), m_end(first + count)
+	{}
+	/* override */ void step()
+	{
+		if (m_next == m_end)
+			throw dyplo::EndOfInputException();
+		m_output.push_one(m_next++);
+	}
+protected:
+	GraphQueue& m_output;
+	int m_next;
+	int m_end;
+};
+
+class Merge: public dyplo::GraphProcess
+{
+public:
+	Merge(GraphQueue& a, GraphQueue& b, GraphQueue& output):
+		m_a(a), m_b(b), m_output(output)
+	{}
+	/* override */ void step()
+	{
+		int value = m_a.pop_one();
+		m_output.push_one(value + m_b.pop_one());
+	}
+protected:
+	GraphQueue& m_a;
+	GraphQueue& m_b;
+	GraphQueue& m_output;
+};
+
+class Split: public dyplo::GraphProcess
+{
+public:
+	Split(GraphQueue& input, GraphQueue& a, GraphQueue& b):
+		m_input(input), m_a(a), m_b(b)
+	{}
+	/* override */ void step()
+	{
+		int value = m_input.pop_one();
+		m_a.push_one(value);
+		m_b.push_one(-value);
+	}
+protected:
+	GraphQueue& m_input;
+	GraphQueue& m_a;
+	GraphQueue& m_b;
+};
+
+class Collect: public dyplo::GraphProcess
+{
+public:
+	std::vector<int> values;
+	Collect(GraphQueue& input): m_input(input) {}
+	/* override */ void step()
+	{
+		values.push_back(m_input.pop_one());
+	}
+protected:
+	GraphQueue& m_input;
+};
+
+struct graph_scheduler {};
+
+TEST(graph_scheduler, merge_and_filter)
+{
+	GraphQueue from_a(2);
+	GraphQueue from_b(2);
+	GraphQueue merged(2);
+	GraphQueue filtered(2);
+	CountingSource a(from_a, 0, 10);
+	CountingSource b(from_b, 100, 20);
+	Merge merge(from_a, from_b, merged);
+	dyplo::GraphFilter<GraphQueue, GraphQueue,
+		process_block_add_one<int, int, 1> > filter(merged, filtered);
+	Collect sink(filtered);
+	dyplo::connect(&a, from_a, &merge);
+	dyplo::connect(&b, from_b, &merge);
+	dyplo::connect(&merge, merged, &filter);
+	dyplo::connect(&filter, filtered, &sink);
+
+	dyplo::GraphExecutor executor;
+	executor.add_sink(&sink);
+	executor.run();
+	/* Stops when the shortest input ends */
+	YAFFUT_EQUAL(10u, sink.values.size());
+	for (int i = 0; i < 10; ++i)
+		YAFFUT_EQUAL(2 * i + 101, sink.values[i]);
+	YAFFUT_CHECK(a.finished());
+}
+
+TEST(graph_scheduler, fan_out)
+{
+	GraphQueue input(2);
+	GraphQueue to_a(2);
+	GraphQueue to_b(1);
+	CountingSource source(input, 1, 5);
+	Split split(input, to_a, to_b);
+	Collect a(to_a);
+	Collect b(to_b);
+	dyplo::connect(&source, input, &split);
+	dyplo::connect(&split, to_a, &a);
+	dyplo::connect(&split, to_b, &b);
+
+	dyplo::GraphExecutor executor;
+	executor.add_sink(&a);
+	executor.add_sink(&b);
+	executor.run();
+	YAFFUT_EQUAL(5u, a.values.size());
+	YAFFUT_EQUAL(5u, b.values.size());
+	for (int i = 0; i < 5; ++i)
+	{
+		YAFFUT_EQUAL(i + 1, a.values[i]);
+		YAFFUT_EQUAL(-(i + 1), b.values[i]);
+	}
+}
+
+TEST(graph_scheduler, deadlock)
+{
+	/* Writes two elements in one step into a queue that holds one */
+	GraphQueue input(2);
+	GraphQueue narrow(1);
+	CountingSource source(input, 1, 5);
+	dyplo::GraphFilter<GraphQueue, GraphQueue,
+		process_block_add_one<int, int, 2>, 2> filter(input, narrow);
+	Collect sink(narrow);
+	dyplo::connect(&source, input, &filter);
+	dyplo::connect(&filter, narrow, &sink);
+	ASSERT_THROW(sink.fire(), std::runtime_error);
+}
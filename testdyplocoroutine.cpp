@@ -0,0 +1,161 @@
+/*
+ * testdyplocoroutine.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include <vector>
+#include "queue.hpp"
+#include "coroutineprocess.hpp"
+
+#include "yaffut.h"
+
+typedef dyplo::FixedMemoryQueue<int, dyplo::CoroutineScheduler> CoroutineQueue;
+
+static dyplo::CoroutineProcess add_one(CoroutineQueue& input, CoroutineQueue& output)
+{
+	for (;;)
+	{
+		int *src;
+		int *dest;
+		unsigned int count = co_await dyplo::async_begin_read(input, src, 1);
+		unsigned int room = co_await dyplo::async_begin_write(output, dest, 1);
+		if (count > room)
+			count = room;
+		for (unsigned int i = 0; i < count; ++i)
+			dest[i] = src[i] + 1;
+		output.end_write(count);
+		input.end_read(count);
+	}
+}
+
+/* Reads pairs, to check waiting for more than one element */
+static dyplo::CoroutineProcess add_pairs(CoroutineQueue& input, CoroutineQueue& output)
+{
+	for (;;)
+	{
+		int *src;
+		int *dest;
+		co_await dyplo::async_begin_read(input, src, 2);
+		co_await dyplo::async_begin_write(output, dest, 1);
+		*dest = src[0] + src[1];
+		output.end_write(1);
+		input.end_read(2);
+	}
+}
+
+struct coroutine_process {};
+
+TEST(coroutine_process, single_stage)
+{
+	dyplo::CoroutineRunner runner;
+	CoroutineQueue input(4);
+	CoroutineQueue output(2);
+	runner.spawn(add_one(input, output));
+	YAFFUT_CHECK(runner.run());
+	YAFFUT_CHECK(!runner.run()); /* Waiting for input */
+	for (int i = 0; i < 4; ++i)
+		input.push_one(i);
+	/* Output is smaller than input, pop_one runs the stage */
+	for (int i = 0; i < 4; ++i)
+		YAFFUT_EQUAL(i + 1, output.pop_one());
+	YAFFUT_CHECK(input.empty());
+	YAFFUT_EQUAL(1u, runner.size());
+}
+
+TEST(coroutine_process, wait_for_count)
+{
+	dyplo::CoroutineRunner runner;
+	CoroutineQueue input(4);
+	CoroutineQueue output(4);
+	runner.spawn(add_pairs(input, output));
+	runner.run();
+	input.push_one(1);
+	runner.run();
+	YAFFUT_CHECK(output.empty());
+	input.push_one(2);
+	runner.run();
+	YAFFUT_EQUAL(3, output.pop_one());
+}
+
+TEST(coroutine_process, many_stages)
+{
+	const unsigned int stages = 2000;
+	dyplo::CoroutineRunner runner;
+	std::vector<CoroutineQueue*> queues;
+	for (unsigned int i = 0; i <= stages; ++i)
+		queues.push_back(new CoroutineQueue(2));
+	for (unsigned int i = 0; i < stages; ++i)
+		runner.spawn(add_one(*queues[i], *queues[i + 1]));
+	runner.run();
+	for (int i = 0; i < 10; ++i)
+	{
+		queues[0]->push_one(i);
+		YAFFUT_EQUAL((int)(i + stages), queues[stages]->pop_one());
+	}
+	/* Interrupting ends the stages one by one */
+	for (unsigned int i = 0; i <= stages; ++i)
+		queues[i]->interrupt_read();
+	runner.run();
+	YAFFUT_EQUAL(0u, runner.size());
+	for (unsigned int i = 0; i <= stages; ++i)
+		delete queues[i];
+}
+
+TEST(coroutine_process, would_block)
+{
+	CoroutineQueue queue(2);
+	dyplo::CoroutineRunner runner;
+	ASSERT_THROW(queue.pop_one(), std::runtime_error);
+}
+
+TEST(coroutine_process, runner_destroyed_first)
+{
+	CoroutineQueue input(2);
+	CoroutineQueue output(2);
+	{
+		dyplo::CoroutineRunner runner;
+		runner.spawn(add_one(input, output));
+		runner.run(); /* Suspended on input */
+	}
+	/* Must not touch the destroyed coroutine or runner */
+	input.interrupt_read();
+	input.resume_read();
+	input.push_one(1);
+	ASSERT_THROW(output.pop_one(), std::runtime_error);
+}
+
+TEST(coroutine_process, queue_destroyed_first)
+{
+	dyplo::CoroutineRunner runner;
+	CoroutineQueue output(2);
+	{
+		CoroutineQueue input(2);
+		runner.spawn(add_one(input, output));
+		runner.run(); /* Suspended on input */
+	}
+	YAFFUT_EQUAL(1u, runner.size());
+	/* The runner destroys the frame, which must not touch input */
+}
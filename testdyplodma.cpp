@@ -0,0 +1,826 @@
+/*
+ * testdyplodma.cpp
+ *
+ * Dyplo library for Kahn processing networks.
+ *
+ * (C) Copyright 2013,2014 Topic Embedded Products B.V. (http://www.topic.nl).
+ * All rights reserved.
+ *
+ * This file is part of libdyplo.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA or see <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Topic by electronic mail via info@topic.nl or via
+ * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <deque>
+#include <vector>
+#include "dmaqueue.hpp"
+#include "dmastripe.hpp"
+#include "reactor.hpp"
+#include "dmaspin.hpp"
+#include "dmasplit.hpp"
+#include "dmaplanner.hpp"
+#include "thread.hpp"
+#include "threadedprocess.hpp"
+#include "scopedlock.hpp"
+
+#include "yaffut.h"
+
+/* User space stand-in for a DMA node that is routed back to another
+ * DMA node. Blocks enqueued on the writing side arrive in the blocks
+ * of the reading side. Write blocks complete immediately. Like the
+ * driver, blocking behaviour depends on the O_NONBLOCK flag of the
+ * handle, and the handle becomes readable when data arrives. */
+class DMALoopback
+{
+public:
+	dyplo::Mutex mutex;
+	dyplo::Condition data_available;
+	std::deque<std::vector<char> > frames;
+	std::deque<uint16_t> user_signals;
+	int event_handle;
+	bool signalled;
+
+	DMALoopback():
+		event_handle(::eventfd(0, 0)),
+		signalled(false)
+	{
+		if (event_handle == -1)
+			throw dyplo::IOException();
+	}
+	~DMALoopback()
+	{
+		::close(event_handle);
+	}
+	/* Call with mutex held */
+	void update_event()
+	{
+		if (frames.empty() == !signalled)
+			return;
+		uint64_t value = 1;
+		if (signalled)
+			::read(event_handle, &value, sizeof(value));
+		else
+			::write(event_handle, &value, sizeof(value));
+		signalled = !signalled;
+	}
+};
+
+class LoopbackDMAFifo
+{
+public:
+	typedef dyplo::HardwareDMAFifo::Block Block;
+
+	LoopbackDMAFifo(DMALoopback& link, bool direction_from_logic,
+			unsigned int blocksize, unsigned int count):
+		m_link(link),
+		m_direction_from_logic(direction_from_logic),
+		m_storage(blocksize * count),
+		m_blocks(count),
+		m_head(0),
+		m_handle(direction_from_logic ? ::dup(link.event_handle) : ::eventfd(0, 0)),
+		dequeue_count(0),
+		enqueue_count(0)
+	{
+		if (m_handle == -1)
+			throw dyplo::IOException();
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			Block& block = m_blocks[i];
+			block.id = i;
+			block.offset = i * blocksize;
+			block.size = blocksize;
+			block.bytes_used = 0;
+			block.user_signal = 0;
+			block.state = 0;
+			block.data = &m_storage[block.offset];
+		}
+	}
+	~LoopbackDMAFifo()
+	{
+		::close(m_handle);
+	}
+
+	Block* dequeue()
+	{
+		Block* block = &m_blocks[m_head];
+		if (block->state)
+		{
+			dyplo::ScopedLock<dyplo::Mutex> lock(m_link.mutex);
+			while (m_link.frames.empty())
+			{
+				if (::fcntl(m_handle, F_GETFL) & O_NONBLOCK)
+				{
+					errno = EAGAIN;
+					return NULL;
+				}
+				m_link.data_available.wait(m_link.mutex);
+			}
+			std::vector<char>& frame = m_link.frames.front();
+			unsigned int bytes = std::min((unsigned int)frame.size(), block->size);
+			memcpy(block->data, &frame[0], bytes);
+			block->bytes_used = bytes;
+			block->user_signal = m_link.user_signals.front();
+			if (bytes < frame.size())
+				frame.erase(frame.begin(), frame.begin() + bytes);
+			else
+			{
+				m_link.frames.pop_front();
+				m_link.user_signals.pop_front();
+			}
+			m_link.update_event();
+			block->state = 0;
+		}
+		++dequeue_count;
+		m_head = (m_head + 1) % m_blocks.size();
+		return block;
+	}
+
+	void enqueue(Block* block)
+	{
+		++enqueue_count;
+		if (m_direction_from_logic)
+		{
+			block->state = 1;
+			return;
+		}
+		dyplo::ScopedLock<dyplo::Mutex> lock(m_link.mutex);
+		if (block->bytes_used)
+		{
+			m_link.frames.push_back(std::vector<char>(
+				(char*)block->data, (char*)block->data + block->bytes_used));
+			m_link.user_signals.push_back(block->user_signal);
+			m_link.update_event();
+			m_link.data_available.signal();
+		}
+	}
+
+	void flush() {}
+	unsigned int count() const { return m_blocks.size(); }
+	const Block* at(uint32_t id) const { return &m_blocks[id]; }
+	operator int() const { return m_handle; }
+
+protected:
+	DMALoopback& m_link;
+	bool m_direction_from_logic;
+	std::vector<char> m_storage;
+	std::vector<Block> m_blocks;
+	unsigned int m_head;
+	int m_handle;
+public:
+	unsigned int dequeue_count;
+	unsigned int enqueue_count;
+};
+
+template <class T, int raise, int blocksize> void dma_add_constant(T* dest, T* src)
+{
+	for (int i = 0; i < blocksize; ++i)
+		*dest++ = (*src++) + raise;
+}
+
+struct dma_queue {};
+
+TEST(dma_queue, write_directly_into_blocks)
+{
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 64, 2);
+	dyplo::FilePollScheduler scheduler;
+	dyplo::DMAOutputQueue<int, LoopbackDMAFifo> output(scheduler, to_logic);
+	int *data;
+	EQUAL(64 / sizeof(int), output.begin_write(data, 1));
+	EQUAL((int*)to_logic.at(0)->data, data);
+	for (int i = 0; i < 3; ++i)
+		data[i] = i + 1;
+	output.end_write(3);
+	EQUAL(1u, link.frames.size());
+	EQUAL(3 * sizeof(int), link.frames.front().size());
+	EQUAL(3, ((int*)&link.frames.front()[0])[2]);
+	/* Next write goes into the next block */
+	output.begin_write(data, 16);
+	EQUAL((int*)to_logic.at(1)->data, data);
+	output.end_write(0);
+	/* Still the same block, end_write(0) does not submit it */
+	output.begin_write(data, 0);
+	EQUAL((int*)to_logic.at(1)->data, data);
+	EQUAL(1u, link.frames.size());
+	/* Asking for more than fits in a block is an error */
+	ASSERT_THROW(output.begin_write(data, 17), std::runtime_error);
+}
+
+TEST(dma_queue, read_across_blocks)
+{
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 16, 4);
+	LoopbackDMAFifo from_logic(link, true, 16, 4);
+	dyplo::FilePollScheduler scheduler;
+	dyplo::DMAOutputQueue<int, LoopbackDMAFifo> output(scheduler, to_logic);
+	dyplo::DMAInputQueue<int, LoopbackDMAFifo> input(scheduler, from_logic);
+	int *data;
+	/* Nothing there yet, must not block */
+	EQUAL(0u, input.begin_read(data, 0));
+	for (int i = 0; i < 12; ++i)
+		output.push_one(i);
+	/* Each push_one was a separate frame, so 12 blocks of 4 bytes */
+	unsigned int count = input.begin_read(data, 1);
+	EQUAL(1u, count);
+	EQUAL((int*)from_logic.at(0)->data, data);
+	EQUAL(0, *data);
+	input.end_read(1);
+	/* Spans three blocks, served from the carry buffer */
+	count = input.begin_read(data, 3);
+	EQUAL(3u, count);
+	for (int i = 0; i < 3; ++i)
+		EQUAL(i + 1, data[i]);
+	input.end_read(2);
+	EQUAL(3, input.pop_one());
+	for (int i = 4; i < 12; ++i)
+		EQUAL(i, input.pop_one());
+	EQUAL(0u, input.begin_read(data, 0));
+	/* Elements must not be split at block boundaries */
+	link.frames.push_back(std::vector<char>(26, 1));
+	link.user_signals.push_back(0);
+	link.update_event();
+	count = input.begin_read(data, 1);
+	EQUAL(4u, count);
+	EQUAL((int*)from_logic.at(0)->data, data);
+	input.end_read(4);
+	count = input.begin_read(data, 2);
+	EQUAL(2u, count);
+	EQUAL(0x01010101, data[1]);
+	input.end_read(2);
+	/* Two bytes left, not a complete element */
+	EQUAL(0u, input.begin_read(data, 0));
+	input.end_read(0);
+}
+
+TEST(dma_queue, software_process_between_dma_nodes)
+{
+	static const int blocksize = 8;
+	typedef dyplo::DMAInputQueue<int, LoopbackDMAFifo> InputQueue;
+	typedef dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> OutputQueue;
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 64, 4);
+	LoopbackDMAFifo from_logic(link, true, 48, 4);
+	dyplo::FilePollScheduler input_scheduler;
+	dyplo::FilePollScheduler output_scheduler;
+	dyplo::DMAOutputQueue<int, LoopbackDMAFifo> output(output_scheduler, to_logic);
+	InputQueue input(input_scheduler, from_logic);
+	OutputQueue results(blocksize);
+	dyplo::ThreadedProcess<InputQueue, OutputQueue,
+		dma_add_constant<int, 5, blocksize>, blocksize> process;
+	process.set_input(&input);
+	process.set_output(&results);
+	int value = 0;
+	for (int frame = 0; frame < 20; ++frame)
+	{
+		int *data;
+		unsigned int count = output.begin_write(data, blocksize);
+		EQUAL(16u, count);
+		for (unsigned int i = 0; i < count; ++i)
+			data[i] = value++;
+		output.end_write(count);
+	}
+	for (int i = 0; i < value; ++i)
+		EQUAL(i + 5, results.pop_one());
+	/* All blocks were dequeued from the mapped buffers directly */
+	CHECK(from_logic.dequeue_count >= 20 * 64 / 48);
+	/* Blocks on the input, must be interruptable */
+	process.terminate();
+}
+
+typedef dyplo::StripedDMAChannel<LoopbackDMAFifo> LoopbackStripe;
+
+struct dma_stripe
+{
+	static const unsigned int nodes = 3;
+	std::vector<DMALoopback*> links;
+	std::vector<LoopbackDMAFifo*> to_logic;
+	std::vector<LoopbackDMAFifo*> from_logic;
+
+	dma_stripe()
+	{
+		for (unsigned int i = 0; i < nodes; ++i)
+		{
+			links.push_back(new DMALoopback());
+			to_logic.push_back(new LoopbackDMAFifo(*links[i], false, 32, 2));
+			from_logic.push_back(new LoopbackDMAFifo(*links[i], true, 32, 2));
+		}
+	}
+	~dma_stripe()
+	{
+		for (unsigned int i = 0; i < nodes; ++i)
+		{
+			delete from_logic[i];
+			delete to_logic[i];
+			delete links[i];
+		}
+	}
+};
+
+TEST(dma_stripe, round_robin_in_sequence)
+{
+	LoopbackStripe writer(to_logic, false);
+	LoopbackStripe reader(from_logic, true);
+	EQUAL(2 * nodes, reader.count());
+	dyplo::FilePollScheduler scheduler;
+	dyplo::DMAOutputQueue<int, LoopbackStripe> output(scheduler, writer);
+	dyplo::DMAInputQueue<int, LoopbackStripe> input(scheduler, reader);
+	/* Priming gave all blocks to the "logic" */
+	for (unsigned int i = 0; i < nodes; ++i)
+		EQUAL(2u, from_logic[i]->enqueue_count);
+	int value = 0;
+	for (unsigned int block = 0; block < 20; ++block)
+	{
+		int *data;
+		unsigned int count = output.begin_write(data, 8);
+		EQUAL(8u, count);
+		for (unsigned int i = 0; i < count; ++i)
+			data[i] = value++;
+		output.end_write(count);
+	}
+	/* Spread evenly, and tagged with the sequence */
+	EQUAL(7u, links[0]->frames.size());
+	EQUAL(7u, links[1]->frames.size());
+	EQUAL(6u, links[2]->frames.size());
+	EQUAL(0u, links[0]->user_signals[0]);
+	EQUAL(3u, links[0]->user_signals[1]);
+	EQUAL(2u, links[2]->user_signals[0]);
+	EQUAL(0u, links[1]->user_signals[5]); /* 16 wraps to 0 */
+	for (int i = 0; i < value; ++i)
+		EQUAL(i, input.pop_one());
+	int *data;
+	EQUAL(0u, input.begin_read(data, 0));
+}
+
+TEST(dma_stripe, detect_out_of_sequence)
+{
+	LoopbackStripe reader(from_logic, true);
+	reader.prime();
+	for (unsigned int i = 0; i < nodes; ++i)
+		EQUAL(2u, from_logic[i]->enqueue_count);
+	links[0]->frames.push_back(std::vector<char>(32, 0));
+	links[0]->user_signals.push_back(0);
+	LoopbackStripe::Block *block = reader.dequeue();
+	EQUAL(0u, block->user_signal);
+	reader.enqueue(block);
+	EQUAL(3u, from_logic[0]->enqueue_count);
+	/* Node 1 delivers the block for sequence 2, so one got lost */
+	links[1]->frames.push_back(std::vector<char>(32, 0));
+	links[1]->user_signals.push_back(2);
+	ASSERT_THROW(reader.dequeue(), std::runtime_error);
+}
+
+class CountingSender: public dyplo::DMACompletionHandler<LoopbackDMAFifo>
+{
+public:
+	unsigned int frames_to_send;
+	int value;
+
+	CountingSender(dyplo::Reactor& reactor, LoopbackDMAFifo& fifo, unsigned int frames):
+		dyplo::DMACompletionHandler<LoopbackDMAFifo>(reactor, fifo, false),
+		frames_to_send(frames),
+		value(0)
+	{
+	}
+
+	virtual void completed(Block* block)
+	{
+		if (!frames_to_send)
+			return;
+		int* data = (int*)block->data;
+		for (unsigned int i = 0; i < block->size / sizeof(int); ++i)
+			data[i] = value++;
+		block->bytes_used = block->size;
+		--frames_to_send;
+		enqueue(block);
+	}
+};
+
+class CountingReceiver: public dyplo::DMACompletionHandler<LoopbackDMAFifo>
+{
+public:
+	unsigned int frames_received;
+	int expected;
+	unsigned int errors;
+
+	CountingReceiver(dyplo::Reactor& reactor, LoopbackDMAFifo& fifo):
+		dyplo::DMACompletionHandler<LoopbackDMAFifo>(reactor, fifo, true),
+		frames_received(0),
+		expected(0),
+		errors(0)
+	{
+	}
+
+	virtual void completed(Block* block)
+	{
+		const int* data = (const int*)block->data;
+		for (unsigned int i = 0; i < block->bytes_used / sizeof(int); ++i)
+			if (data[i] != expected++)
+				++errors;
+		++frames_received;
+		block->bytes_used = block->size;
+		enqueue(block);
+	}
+};
+
+class StopAfter: public dyplo::ReactorTimer
+{
+public:
+	unsigned int remaining;
+	unsigned int expirations;
+
+	StopAfter(dyplo::Reactor& reactor, unsigned int count):
+		dyplo::ReactorTimer(reactor),
+		remaining(count),
+		expirations(0)
+	{
+	}
+
+	virtual void expired(unsigned int count)
+	{
+		expirations += count;
+		if (--remaining == 0)
+		{
+			stop();
+			m_reactor.stop();
+		}
+	}
+};
+
+struct dma_reactor {};
+
+TEST(dma_reactor, one_thread_services_all_nodes)
+{
+	static const unsigned int nodes = 8;
+	static const unsigned int frames = 50;
+	dyplo::Reactor reactor;
+	std::vector<DMALoopback*> links;
+	std::vector<LoopbackDMAFifo*> fifos;
+	std::vector<CountingSender*> senders;
+	std::vector<CountingReceiver*> receivers;
+	for (unsigned int i = 0; i < nodes; ++i)
+	{
+		links.push_back(new DMALoopback());
+		fifos.push_back(new LoopbackDMAFifo(*links[i], false, 64, 3));
+		senders.push_back(new CountingSender(reactor, *fifos.back(), frames));
+		fifos.push_back(new LoopbackDMAFifo(*links[i], true, 64, 3));
+		receivers.push_back(new CountingReceiver(reactor, *fifos.back()));
+		receivers.back()->start();
+		EQUAL(3u, receivers.back()->pending());
+	}
+	for (unsigned int i = 0; i < nodes; ++i)
+		senders[i]->start();
+	unsigned int received;
+	unsigned int loops = 0;
+	do
+	{
+		reactor.poll(1000);
+		received = 0;
+		for (unsigned int i = 0; i < nodes; ++i)
+			received += receivers[i]->frames_received;
+		++loops;
+	} while ((received < nodes * frames) && (loops < 1000));
+	EQUAL(nodes * frames, received);
+	for (unsigned int i = 0; i < nodes; ++i)
+	{
+		EQUAL(0u, senders[i]->frames_to_send);
+		EQUAL(0u, senders[i]->pending());
+		EQUAL(frames, receivers[i]->frames_received);
+		EQUAL(0u, receivers[i]->errors);
+	}
+	/* Nothing left to do, must time out */
+	EQUAL(0u, reactor.poll(0));
+	for (unsigned int i = 0; i < nodes; ++i)
+	{
+		delete receivers[i];
+		delete senders[i];
+		delete fifos[2*i + 1];
+		delete fifos[2*i];
+		delete links[i];
+	}
+}
+
+TEST(dma_reactor, timer_and_stop)
+{
+	dyplo::Reactor reactor;
+	StopAfter timer(reactor, 3);
+	timer.start(1000, 2000);
+	reactor.run();
+	CHECK(timer.expirations >= 3);
+	/* Stop before run makes it return immediately */
+	reactor.stop();
+	reactor.run();
+	EQUAL(0u, reactor.poll(10));
+}
+
+static void* send_frame_later(void* arg)
+{
+	LoopbackDMAFifo* fifo = (LoopbackDMAFifo*)arg;
+	::usleep(20000);
+	LoopbackDMAFifo::Block* block = fifo->dequeue();
+	block->bytes_used = 4;
+	fifo->enqueue(block);
+	return NULL;
+}
+
+struct dma_spin {};
+
+TEST(dma_spin, spin_backoff_and_block)
+{
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 16, 2);
+	LoopbackDMAFifo from_logic(link, true, 16, 2);
+	dyplo::SpinningDMAFifo<LoopbackDMAFifo> reader(from_logic, true, 10);
+	/* The empty blocks come out without spinning */
+	for (unsigned int i = 0; i < reader.count(); ++i)
+	{
+		LoopbackDMAFifo::Block* block = reader.dequeue();
+		reader.enqueue(block);
+	}
+	EQUAL(2u, reader.statistics().spin);
+	reader.reset_statistics();
+	/* Data already there, first poll returns it */
+	send_frame_later(&to_logic);
+	CHECK(reader.dequeue() != NULL);
+	EQUAL(1u, reader.statistics().spin);
+	EQUAL(0u, reader.statistics().blocked);
+	/* Not within the spin budget, falls back to blocking */
+	dyplo::Thread sender;
+	sender.start(send_frame_later, &to_logic);
+	CHECK(reader.dequeue() != NULL);
+	sender.join();
+	EQUAL(1u, reader.statistics().spin);
+	EQUAL(1u, reader.statistics().blocked);
+	EQUAL(0u, reader.statistics().backoff);
+}
+
+TEST(dma_spin, non_blocking_fallback)
+{
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 16, 2);
+	LoopbackDMAFifo from_logic(link, true, 16, 2);
+	dyplo::SpinningDMAFifo<LoopbackDMAFifo> reader(from_logic, true, 100, 64, false);
+	dyplo::FilePollScheduler scheduler;
+	dyplo::DMAInputQueue<int, dyplo::SpinningDMAFifo<LoopbackDMAFifo> > input(scheduler, reader);
+	int *data;
+	EQUAL(0u, input.begin_read(data, 0));
+	EQUAL(1u, reader.statistics().would_block);
+	/* Arrives during the backoff sleeps */
+	dyplo::Thread sender;
+	reader.set_backoff_max_us(4000000);
+	sender.start(send_frame_later, &to_logic);
+	EQUAL(1u, input.begin_read(data, 1));
+	sender.join();
+	EQUAL(1u, reader.statistics().backoff);
+	EQUAL(1u, reader.statistics().would_block);
+}
+
+typedef dyplo::SplitDMAFifo<LoopbackDMAFifo> LoopbackSplit;
+
+struct SplitThreadContext
+{
+	LoopbackSplit* split;
+	unsigned int frames;
+	int expected;
+	unsigned int errors;
+	bool interrupted;
+
+	SplitThreadContext(LoopbackSplit* s, unsigned int f):
+		split(s), frames(f), expected(0), errors(0), interrupted(false)
+	{}
+};
+
+static void* split_reap_and_release(void* arg)
+{
+	SplitThreadContext* ctx = (SplitThreadContext*)arg;
+	try
+	{
+		for (unsigned int i = 0; i < ctx->frames; ++i)
+			ctx->split->release(ctx->split->reap());
+	}
+	catch (const dyplo::InterruptedException&)
+	{
+		ctx->interrupted = true;
+	}
+	return NULL;
+}
+
+static void* split_reap_and_verify(void* arg)
+{
+	SplitThreadContext* ctx = (SplitThreadContext*)arg;
+	for (unsigned int i = 0; i < ctx->frames; ++i)
+	{
+		LoopbackSplit::Block* block = ctx->split->reap();
+		const int* data = (const int*)block->data;
+		for (unsigned int j = 0; j < block->bytes_used / sizeof(int); ++j)
+			if (data[j] != ctx->expected++)
+				++ctx->errors;
+		ctx->split->release(block);
+	}
+	return NULL;
+}
+
+static void* split_resubmit(void* arg)
+{
+	SplitThreadContext* ctx = (SplitThreadContext*)arg;
+	try
+	{
+		for (;;)
+		{
+			LoopbackSplit::Block* block = ctx->split->acquire();
+			block->bytes_used = block->size;
+			ctx->split->submit(block);
+		}
+	}
+	catch (const dyplo::InterruptedException&)
+	{
+		ctx->interrupted = true;
+	}
+	return NULL;
+}
+
+struct dma_split {};
+
+TEST(dma_split, submit_and_reap_in_parallel)
+{
+	static const unsigned int frames = 500;
+	DMALoopback link;
+	LoopbackDMAFifo to_logic(link, false, 32, 3);
+	LoopbackDMAFifo from_logic(link, true, 32, 3);
+	LoopbackSplit writer(to_logic, false);
+	LoopbackSplit reader(from_logic, true);
+	EQUAL(3u, from_logic.enqueue_count);
+	SplitThreadContext writer_completion(&writer, frames);
+	SplitThreadContext reader_producer(&reader, 0);
+	SplitThreadContext reader_completion(&reader, frames);
+	dyplo::Thread writer_completion_thread;
+	dyplo::Thread reader_producer_thread;
+	dyplo::Thread reader_completion_thread;
+	writer_completion_thread.start(split_reap_and_release, &writer_completion);
+	reader_producer_thread.start(split_resubmit, &reader_producer);
+	reader_completion_thread.start(split_reap_and_verify, &reader_completion);
+	int value = 0;
+	for (unsigned int i = 0; i < frames; ++i)
+	{
+		LoopbackSplit::Block* block = writer.acquire();
+		int* data = (int*)block->data;
+		for (unsigned int j = 0; j < block->size / sizeof(int); ++j)
+			data[j] = value++;
+		block->bytes_used = block->size;
+		writer.submit(block);
+	}
+	writer_completion_thread.join();
+	reader_completion_thread.join();
+	reader.interrupt();
+	reader_producer_thread.join();
+	CHECK(!writer_completion.interrupted);
+	CHECK(reader_producer.interrupted);
+	EQUAL(0u, reader_completion.errors);
+	EQUAL(value, reader_completion.expected);
+	EQUAL(frames, to_logic.enqueue_count);
+}
+
+TEST(dma_split, interrupt_waiting_threads)
+{
+	DMALoopback link;
+	LoopbackDMAFifo from_logic(link, true, 32, 2);
+	LoopbackSplit reader(from_logic, true);
+	/* Nothing arrives, so reap waits for the logic */
+	SplitThreadContext completion(&reader, 1);
+	dyplo::Thread thread;
+	thread.start(split_reap_and_release, &completion);
+	::usleep(10000);
+	reader.interrupt();
+	thread.join();
+	CHECK(completion.interrupted);
+	/* Nothing released, so acquire waits too */
+	ASSERT_THROW(reader.acquire(), dyplo::InterruptedException);
+	reader.resume();
+	/* The block reap was waiting for is still the one expected */
+	link.frames.push_back(std::vector<char>(8, 1));
+	link.user_signals.push_back(0);
+	LoopbackSplit::Block* block = reader.reap();
+	EQUAL(from_logic.at(0), block);
+	EQUAL(8u, block->bytes_used);
+	reader.release(block);
+	EQUAL(block, reader.acquire());
+}
+
+static void check_plan(const dyplo::DMARegion& region, uint32_t max_burst_size)
+{
+	dyplo::StandalonePlan plan = dyplo::planStandaloneTransfer(region, max_burst_size);
+	dyplo::DMATransferList expected;
+	dyplo::DMATransferList actual;
+	dyplo::expandDMARegion(region, expected);
+	dyplo::expandStandalonePlan(plan, actual);
+	CHECK(expected == actual);
+	for (unsigned int i = 0; i < plan.size(); ++i)
+	{
+		CHECK(!max_burst_size || plan[i].burst_size <= max_burst_size);
+		EQUAL(0u, plan[i].burst_size % region.element_size);
+	}
+}
+
+struct dma_planner {};
+
+TEST(dma_planner, contiguous_and_pitched_images)
+{
+	/* Contiguous image is a single burst */
+	dyplo::DMARegion image(0x1000, 2, 640, 480);
+	dyplo::StandalonePlan plan = dyplo::planStandaloneTransfer(image);
+	EQUAL(1u, plan.size());
+	EQUAL(0x1000u, plan[0].offset);
+	EQUAL(640u * 480u * 2u, plan[0].burst_size);
+	EQUAL(1u, plan[0].iterations_a);
+	EQUAL(1u, plan[0].iterations_b);
+	EQUAL(1u, plan[0].iterations_c);
+	/* Pitched image, one burst per row */
+	dyplo::DMARegion pitched(0, 2, 640, 480, 2048);
+	plan = dyplo::planStandaloneTransfer(pitched);
+	EQUAL(1u, plan.size());
+	EQUAL(1280u, plan[0].burst_size);
+	EQUAL(480u, plan[0].iterations_a);
+	EQUAL(2048u, plan[0].incr_a);
+	check_plan(pitched, 0);
+	/* Bursts limited, rows split into equal parts and merged */
+	dyplo::DMARegion hd(0, 4, 1920, 1080);
+	plan = dyplo::planStandaloneTransfer(hd, 4096);
+	EQUAL(1u, plan.size());
+	EQUAL(3840u, plan[0].burst_size);
+	EQUAL(2160u, plan[0].iterations_a);
+	EQUAL(3840u, plan[0].incr_a);
+	check_plan(hd, 4096);
+	/* Same configuration must compare equal */
+	dyplo::StandalonePlan again = dyplo::planStandaloneTransfer(hd, 4096);
+	CHECK(plan[0] == again[0]);
+	again[0].incr_c = 1;
+	CHECK(plan[0] != again[0]);
+}
+
+TEST(dma_planner, tiles_and_planes)
+{
+	/* 3D with regular tiles needs four loops, so one config per plane */
+	dyplo::DMARegion volume(64, 1, 64, 32, 128);
+	volume.depth = 3;
+	volume.slice_pitch = 8192;
+	volume.tile_width = 16;
+	volume.tile_height = 8;
+	dyplo::StandalonePlan plan = dyplo::planStandaloneTransfer(volume);
+	EQUAL(3u, plan.size());
+	EQUAL(16u, plan[0].burst_size);
+	EQUAL(8u, plan[0].iterations_a);
+	EQUAL(128u, plan[0].incr_a);
+	EQUAL(4u, plan[0].iterations_b);
+	EQUAL(16u, plan[0].incr_b);
+	EQUAL(4u, plan[0].iterations_c);
+	EQUAL(8u * 128u, plan[0].incr_c);
+	EQUAL(64u + 8192u, plan[1].offset);
+	check_plan(volume, 0);
+	/* Compare with the reference for a range of odd shapes */
+	static const uint32_t element_sizes[] = {1, 2, 4, 12};
+	for (unsigned int e = 0; e < sizeof(element_sizes)/sizeof(element_sizes[0]); ++e)
+		for (uint32_t width = 1; width <= 13; width += 4)
+			for (uint32_t height = 1; height <= 9; height += 4)
+				for (uint32_t tile = 0; tile <= 4; tile += 2)
+					for (uint32_t depth = 1; depth <= 2; ++depth)
+					{
+						const uint32_t size = element_sizes[e];
+						dyplo::DMARegion region(8, size, width, height,
+							(width + (tile & 1)) * size);
+						region.depth = depth;
+						region.slice_pitch = region.pitch * (height + tile);
+						region.tile_width = tile;
+						region.tile_height = tile + 1;
+						check_plan(region, 0);
+						check_plan(region, 24);
+					}
+}
+
+TEST(dma_planner, invalid_regions)
+{
+	dyplo::DMARegion region(0, 4, 16, 16, 32);
+	ASSERT_THROW(dyplo::planStandaloneTransfer(region), std::invalid_argument);
+	dyplo::DMARegion empty(0, 4, 0, 16);
+	ASSERT_THROW(dyplo::planStandaloneTransfer(empty), std::invalid_argument);
+	dyplo::DMARegion large_elements(0, 16, 4, 4);
+	ASSERT_THROW(dyplo::planStandaloneTransfer(large_elements, 8), std::invalid_argument);
+}
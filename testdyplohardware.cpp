@@ -34,6 +34,9 @@
 #include <list>
 #include <string>
 #include <fstream>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 class TestContext
 {
@@ -266,6 +269,78 @@ TEST(hardware_programmer, partial_file)
 	::unlink("/tmp/xdevcfg");
 }
 
+static void compare_file_contents(dyplo::File& file, const void* expected, size_t size)
+{
+	std::vector<unsigned char> buffer(size + 1);
+	file.seek(0);
+	EQUAL((ssize_t)size, file.read_all(&buffer[0], size + 1));
+	CHECK(memcmp(expected, &buffer[0], size) == 0);
+}
+
+TEST(hardware_programmer, compressed_file)
+{
+	TestContext tc;
+
+	const char* bitstreamPath = "/tmp/bitstream";
+
+	dyplo::File xdevcfg(::open("/tmp/xdevcfg", O_CREAT | O_RDWR, S_IRUSR|S_IWUSR));
+	dyplo::File bitstream(::open(bitstreamPath, O_CREAT | O_WRONLY, S_IRUSR|S_IWUSR));
+	dyplo::File bitstreamToRead = dyplo::File(::open(bitstreamPath, O_RDONLY));
+	dyplo::FpgaImageFileWriter writer(xdevcfg);
+	dyplo::FpgaImageReader reader(writer);
+	std::vector<unsigned char> compressed;
+
+	/* Partial with long runs that span multiple output buffers, and a
+	 * size that is not a multiple of the word size. */
+	std::vector<unsigned char> partial(3 * dyplo::BUFFER_SIZE + 7, 0);
+	memcpy(&partial[0], valid_partial_bitstream, sizeof(valid_partial_bitstream));
+	memset(&partial[dyplo::BUFFER_SIZE], 0xFF, dyplo::BUFFER_SIZE / 2 + 2);
+	for (unsigned int i = 2 * dyplo::BUFFER_SIZE; i < partial.size(); ++i)
+		partial[i] = i * 7;
+	dyplo::compressBitstreamRLE(&partial[0], partial.size(), compressed);
+	CHECK(compressed.size() < partial.size() / 2);
+	bitstream.write(&compressed[0], compressed.size());
+	EQUAL(partial.size(), reader.processFile(bitstreamToRead));
+	compare_file_contents(xdevcfg, &partial[0], partial.size());
+
+	/* Compressed "bit" stream, must remove header and flip bytes */
+	xdevcfg.seek(0);
+	EQUAL(0, ::ftruncate(xdevcfg, 0));
+	EQUAL(0, ::ftruncate(bitstream, 0));
+	bitstream.seek(0);
+	bitstreamToRead.seek(0);
+	dyplo::compressBitstreamRLE(valid_bit_bitstream, sizeof(valid_bit_bitstream), compressed);
+	bitstream.write(&compressed[0], compressed.size());
+	EQUAL(32u, reader.processFile(bitstreamToRead));
+	unsigned char expected[32];
+	for (int i = 0; i < 32; ++i)
+		expected[i] = i + 1;
+	compare_file_contents(xdevcfg, expected, sizeof(expected));
+
+	/* Truncated compressed stream */
+	xdevcfg.seek(0);
+	EQUAL(0, ::ftruncate(xdevcfg, 0));
+	bitstreamToRead.seek(0);
+	EQUAL(0, ::ftruncate(bitstream, compressed.size() - 10));
+	ASSERT_THROW(reader.processFile(bitstreamToRead), dyplo::TruncatedFileException);
+
+#ifdef HAVE_LIBZ
+	/* gzip compressed partial */
+	xdevcfg.seek(0);
+	EQUAL(0, ::ftruncate(xdevcfg, 0));
+	{
+		gzFile gz = gzopen(bitstreamPath, "wb");
+		CHECK(gz != NULL);
+		EQUAL((int)partial.size(), gzwrite(gz, &partial[0], partial.size()));
+		gzclose(gz);
+	}
+	bitstreamToRead.seek(0);
+	EQUAL(partial.size(), reader.processFile(bitstreamToRead));
+	compare_file_contents(xdevcfg, &partial[0], partial.size());
+#endif
+	::unlink("/tmp/xdevcfg");
+}
+
 TEST(hardware_programmer, parse_description_tag)
 {
 	unsigned int user_id = 0;
@@ -377,3 +452,140 @@ TEST(hardware_programmer, find_bitstreams)
 	filename = context.findPartition("dyplo_func_3", 22);
 	EQUAL("", filename); // not found
 }
+
+class ProgrammingSessionCallbackMock : public dyplo::HardwareProgrammingSessionCallback
+{
+public:
+	std::vector<int> nodes;
+	virtual void partitionProgrammed(int node, const std::string& /*filename*/, unsigned int /*bytes*/)
+	{
+		nodes.push_back(node);
+	}
+};
+
+class ProgrammerMock
+{
+public:
+	std::vector<std::string> files;
+	unsigned int flushes;
+	ProgrammerMock(): flushes(0) {}
+	unsigned int fromFile(const char* filename)
+	{
+		/* Nothing may be reported after the flush */
+		CHECK(flushes == 0);
+		files.push_back(filename);
+		return 100 * files.size();
+	}
+	void flush()
+	{
+		++flushes;
+	}
+};
+
+TEST(hardware_programmer, programming_session)
+{
+	TestContext tc; /* Creates fake control device */
+	dyplo::HardwareContext context("/tmp/dyplo");
+	dyplo::HardwareControl control(context);
+	LotsOfFiles f;
+	f.dir("/tmp/dyplo_session");
+	f.file("/tmp/dyplo_session/3.partial");
+	f.file("/tmp/dyplo_session/5.bit");
+	f.file("/tmp/dyplo_session/5.partial");
+	context.setBitstreamBasepath("/tmp");
+
+	dyplo::HardwareProgrammingSession session(context, control);
+	EQUAL(0u, session.size());
+	EQUAL(0u, session.getNodeMask());
+	CHECK(session.add("dyplo_session", 3));
+	CHECK(session.add("dyplo_session", 5));
+	CHECK(!session.add("dyplo_session", 4)); /* No bitstream */
+	session.add(7, "/tmp/dyplo_session/whatever.bin");
+	EQUAL(3u, session.size());
+	EQUAL((1u<<3)|(1u<<5)|(1u<<7), session.getNodeMask());
+	EQUAL(3, session.at(0).node);
+	EQUAL("/tmp/dyplo_session/3.partial", session.at(0).filename);
+	EQUAL("/tmp/dyplo_session/5.partial", session.at(1).filename);
+	EQUAL(0u, session.at(1).bytes);
+	session.clear();
+	EQUAL(0u, session.size());
+}
+
+TEST(hardware_programmer, programming_session_flushes_once)
+{
+	TestContext tc; /* Creates fake control device */
+	dyplo::HardwareContext context("/tmp/dyplo");
+	dyplo::HardwareControl control(context);
+	ProgrammingSessionCallbackMock callback;
+	ProgrammerMock programmer;
+	dyplo::HardwareProgrammingSession session(context, control);
+	session.add(3, "/tmp/dyplo_session/3.partial");
+	session.add(5, "/tmp/dyplo_session/5.partial");
+	session.add(7, "/tmp/dyplo_session/7.partial");
+	EQUAL(600u, session.program(programmer, &callback));
+	EQUAL(1u, programmer.flushes);
+	EQUAL(3u, programmer.files.size());
+	EQUAL("/tmp/dyplo_session/7.partial", programmer.files[2]);
+	/* Each partition reported in order, with its own size */
+	EQUAL(3u, callback.nodes.size());
+	EQUAL(3, callback.nodes[0]);
+	EQUAL(7, callback.nodes[2]);
+	EQUAL(100u, session.at(0).bytes);
+	EQUAL(300u, session.at(2).bytes);
+}
+
+TEST(hardware_programmer, programming_session_execute)
+{
+	TestContext tc; /* Creates fake control device, a plain file */
+	dyplo::HardwareContext context("/tmp/dyplo");
+	dyplo::HardwareControl control(context);
+	ProgrammingSessionCallbackMock callback;
+	dyplo::HardwareProgrammingSession session(context, control);
+	/* Nothing to program, must not touch the device */
+	EQUAL(0u, session.execute(&callback));
+	CHECK(callback.nodes.empty());
+	session.add(31, "/tmp/dyplo_session/whatever.bin");
+	EQUAL(1u<<31, session.getNodeMask());
+	/* A plain file does not accept the ioctl to disable nodes */
+	try
+	{
+		session.execute(&callback);
+		FAIL("execute on a plain file must fail");
+	}
+	catch (const dyplo::IOException&)
+	{
+	}
+	CHECK(callback.nodes.empty());
+	EQUAL(0u, session.at(0).bytes);
+}
+
+TEST(hardware_programmer, find_compressed_bitstreams)
+{
+	dyplo::HardwareContext context("/tmp/dyplo"); /* Fake device */
+	LotsOfFiles f;
+	f.dir("/tmp/dyplo_func_z");
+	f.file("/tmp/dyplo_func_z/1.bit");
+	f.file("/tmp/dyplo_func_z/1.bit.rle");
+	f.file("/tmp/dyplo_func_z/2.bit.rle");
+	f.file("/tmp/dyplo_func_z/2.partial");
+	f.file("/tmp/dyplo_func_z/2.partial.rle");
+	f.file("/tmp/dyplo_func_z/3.bit.rle");
+	f.file("/tmp/dyplo_func_z/3.partial");
+	f.file("/tmp/dyplo_func_z/4.bit");
+	f.file("/tmp/dyplo_func_z/4.partial.gz");
+	f.file("/tmp/dyplo_func_z/5.partial.gz");
+	context.setBitstreamBasepath("/tmp");
+#ifdef HAVE_LIBZ
+	EQUAL((1u<<1)|(1u<<2)|(1u<<3)|(1u<<4)|(1u<<5), context.getAvailablePartitions("dyplo_func_z"));
+	EQUAL("/tmp/dyplo_func_z/4.partial.gz", context.findPartition("dyplo_func_z", 4));
+	EQUAL("/tmp/dyplo_func_z/5.partial.gz", context.findPartition("dyplo_func_z", 5));
+#else
+	/* Cannot decompress, so never programmed raw */
+	EQUAL((1u<<1)|(1u<<2)|(1u<<3)|(1u<<4), context.getAvailablePartitions("dyplo_func_z"));
+	EQUAL("/tmp/dyplo_func_z/4.bit", context.findPartition("dyplo_func_z", 4));
+	EQUAL("", context.findPartition("dyplo_func_z", 5));
+#endif
+	EQUAL("/tmp/dyplo_func_z/1.bit.rle", context.findPartition("dyplo_func_z", 1));
+	EQUAL("/tmp/dyplo_func_z/2.partial.rle", context.findPartition("dyplo_func_z", 2));
+	EQUAL("/tmp/dyplo_func_z/3.partial", context.findPartition("dyplo_func_z", 3));
+}
@@ -27,10 +27,19 @@
  * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
  */
 #include <unistd.h>
+#include <limits.h>
+#include <sys/wait.h>
 #include <string>
 #include "queue.hpp"
 #include "noopscheduler.hpp"
 #include "filequeue.hpp"
+#include "broadcastqueue.hpp"
+#include "framequeue.hpp"
+#include "rawqueue.hpp"
+#include "sharedqueue.hpp"
+#include "socketqueue.hpp"
+#include "realtimememory.hpp"
+#include "thread.hpp"
 
 #include "yaffut.h"
 
@@ -107,6 +116,295 @@ TEST(a_fixed_memory_queue, border_cases)
 	YAFFUT_EQUAL(3u, q.begin_write(data, 1));
 }
 
+class CountingScheduler: public dyplo::NoopScheduler
+{
+public:
+	unsigned int not_full;
+	unsigned int not_empty;
+	CountingScheduler(): not_full(0), not_empty(0) {}
+	void trigger_not_full() { ++not_full; }
+	void trigger_not_empty() { ++not_empty; }
+};
+
+TEST(a_fixed_memory_queue, watermarks)
+{
+	dyplo::FixedMemoryQueue<int, CountingScheduler> q(8);
+	CountingScheduler& s = q.get_scheduler();
+	int* data;
+
+	/* Default triggers on every transfer */
+	q.begin_write(data, 1);
+	q.end_write(1);
+	q.end_write(1);
+	YAFFUT_EQUAL(2u, s.not_empty);
+	q.begin_read(data, 1);
+	q.end_read(1);
+	q.end_read(1);
+	YAFFUT_EQUAL(2u, s.not_full);
+
+	q.set_read_watermark(4);
+	q.set_write_watermark(6);
+	s.not_empty = 0;
+	s.not_full = 0;
+	for (int i = 0; i < 6; ++i)
+		q.end_write(1);
+	/* Only when crossing 4 */
+	YAFFUT_EQUAL(1u, s.not_empty);
+	q.end_read(3); /* 5 free */
+	YAFFUT_EQUAL(0u, s.not_full);
+	q.end_read(1); /* 6 free */
+	YAFFUT_EQUAL(1u, s.not_full);
+	q.end_read(2); /* Stays above */
+	YAFFUT_EQUAL(1u, s.not_full);
+
+	/* Flush triggers regardless */
+	q.end_write(1);
+	YAFFUT_EQUAL(1u, s.not_empty);
+	q.flush();
+	YAFFUT_EQUAL(2u, s.not_empty);
+	YAFFUT_EQUAL(2u, s.not_full);
+
+	/* Watermark larger than the queue is clipped to its capacity */
+	q.set_read_watermark(100);
+	q.end_write(6);
+	YAFFUT_EQUAL(2u, s.not_empty);
+	q.end_write(1);
+	YAFFUT_EQUAL(3u, s.not_empty);
+}
+
+struct a_broadcast_queue {};
+
+TEST(a_broadcast_queue, readers_share_buffer)
+{
+	dyplo::BroadcastQueue<int, dyplo::NoopScheduler> q(4, 2);
+	int* data;
+	YAFFUT_EQUAL(4u, q.begin_write(data, 1));
+	data[0] = 1;
+	data[1] = 2;
+	data[2] = 3;
+	q.end_write(3);
+	YAFFUT_EQUAL(1u, q.available());
+	/* Same memory for both readers */
+	int* a;
+	int* b;
+	YAFFUT_EQUAL(3u, q.reader(0).begin_read(a, 1));
+	YAFFUT_EQUAL(3u, q.reader(1).begin_read(b, 1));
+	YAFFUT_EQUAL(a, b);
+	q.reader(0).end_read(3);
+	/* The slowest reader determines the room */
+	YAFFUT_EQUAL(1u, q.available());
+	YAFFUT_EQUAL(1, q.reader(1).pop_one());
+	YAFFUT_EQUAL(2u, q.available());
+	q.push_one(4);
+	q.push_one(5); /* Wraps */
+	YAFFUT_EQUAL(2u, q.reader(0).size());
+	YAFFUT_EQUAL(4, q.reader(0).pop_one());
+	YAFFUT_EQUAL(5, q.reader(0).pop_one());
+	YAFFUT_EQUAL(2, q.reader(1).pop_one());
+	YAFFUT_EQUAL(3, q.reader(1).pop_one());
+	YAFFUT_EQUAL(4, q.reader(1).pop_one());
+	YAFFUT_EQUAL(5, q.reader(1).pop_one());
+	YAFFUT_EQUAL(4u, q.available());
+}
+
+struct WrappingBroadcastQueue: public dyplo::BroadcastQueue<int, dyplo::NoopScheduler>
+{
+	WrappingBroadcastQueue(unsigned int capacity, unsigned int readers, unsigned int position):
+		dyplo::BroadcastQueue<int, dyplo::NoopScheduler>(capacity, readers)
+	{
+		reset_position(position);
+	}
+};
+
+TEST(a_broadcast_queue, positions_wrap)
+{
+	/* 2^32 is not a multiple of 3 */
+	WrappingBroadcastQueue q(3, 2, UINT_MAX - 5);
+	YAFFUT_EQUAL(4u, q.capacity());
+	int next = 0;
+	int expected[2] = {0, 0};
+	for (unsigned int round = 0; round < 10; ++round)
+	{
+		int* data;
+		unsigned int count = q.begin_write(data, 1);
+		for (unsigned int i = 0; i < count; ++i)
+			data[i] = next++;
+		q.end_write(count);
+		for (unsigned int r = 0; r < 2; ++r)
+		{
+			/* Reader 1 lags behind by reading one at a time */
+			while (!q.reader(r).empty())
+			{
+				count = q.reader(r).begin_read(data, 1);
+				if (r == 1)
+					count = 1;
+				for (unsigned int i = 0; i < count; ++i)
+					YAFFUT_EQUAL(expected[r]++, data[i]);
+				q.reader(r).end_read(count);
+			}
+		}
+	}
+	YAFFUT_CHECK(next > 10);
+	YAFFUT_EQUAL(next, expected[0]);
+	YAFFUT_EQUAL(next, expected[1]);
+}
+
+struct a_frame_queue {};
+
+TEST(a_frame_queue, variable_length)
+{
+	dyplo::FrameQueue<dyplo::NoopScheduler> q(64);
+	void* data;
+	unsigned int user_signal;
+	for (unsigned int round = 0; round < 20; ++round)
+	{
+		/* Lengths that make frames wrap at different places */
+		const unsigned int length = 1 + (round * 7) % 20;
+		char* buffer = (char*)q.begin_write(24);
+		for (unsigned int i = 0; i < length; ++i)
+			buffer[i] = round + i;
+		q.end_write(length, round & 0xF);
+		q.push("x", 1, 1);
+		YAFFUT_EQUAL(2u, q.size());
+		YAFFUT_EQUAL(length, q.begin_read(data, user_signal));
+		YAFFUT_EQUAL(round & 0xF, user_signal);
+		for (unsigned int i = 0; i < length; ++i)
+			YAFFUT_EQUAL((char)(round + i), ((char*)data)[i]);
+		q.end_read();
+		YAFFUT_EQUAL(1u, q.begin_read(data, user_signal));
+		YAFFUT_EQUAL('x', *(char*)data);
+		q.end_read();
+		YAFFUT_CHECK(q.empty());
+	}
+	YAFFUT_EQUAL(0u, q.bytes_used());
+	ASSERT_THROW(q.begin_write(100), std::invalid_argument);
+}
+
+TEST(a_frame_queue, fill_up)
+{
+	dyplo::FrameQueue<dyplo::NoopScheduler> q(64);
+	/* Each frame takes 16 bytes */
+	for (int i = 0; i < 4; ++i)
+		q.push(&i, sizeof(i));
+	YAFFUT_EQUAL(64u, q.bytes_used());
+	ASSERT_THROW(q.begin_write(1), std::runtime_error);
+	void* data;
+	q.begin_read(data);
+	q.end_read();
+	q.push("abc", 3); /* At the start again */
+	for (int i = 1; i < 4; ++i)
+	{
+		YAFFUT_EQUAL(sizeof(int), q.begin_read(data));
+		YAFFUT_EQUAL(i, *(int*)data);
+		q.end_read();
+	}
+	YAFFUT_EQUAL(3u, q.begin_read(data));
+	q.end_read();
+}
+
+struct FakeFramedFifo
+{
+	std::string data;
+	int user_signal;
+	void setUserSignal(int value) { user_signal = value; }
+	int getUserSignal() { return user_signal; }
+	ssize_t write(const void* buffer, size_t count)
+	{
+		data.append((const char*)buffer, count);
+		return count;
+	}
+	ssize_t read(void* buffer, size_t count)
+	{
+		count = std::min(count, data.size());
+		memcpy(buffer, data.data(), count);
+		data.erase(0, count);
+		return count;
+	}
+};
+
+TEST(a_frame_queue, cpu_fifo_user_signals)
+{
+	dyplo::FrameQueue<dyplo::NoopScheduler> q(256);
+	FakeFramedFifo fifo;
+	q.push("hello", 5, 3);
+	dyplo::write_frame(q, fifo);
+	YAFFUT_EQUAL(3, fifo.user_signal);
+	YAFFUT_EQUAL("hello", fifo.data);
+	YAFFUT_EQUAL(5u, dyplo::read_frame(q, fifo, 100));
+	void* data;
+	unsigned int user_signal;
+	YAFFUT_EQUAL(5u, q.begin_read(data, user_signal));
+	YAFFUT_EQUAL(3u, user_signal);
+	YAFFUT_EQUAL(0, memcmp(data, "hello", 5));
+	q.end_read();
+}
+
+/* Counts what happens to it */
+struct Tracked
+{
+	static int alive;
+	static int copies;
+	static int moves;
+	int value;
+	Tracked(int v): value(v) { ++alive; }
+	Tracked(const Tracked& other): value(other.value) { ++alive; ++copies; }
+	Tracked(Tracked&& other): value(other.value) { ++alive; ++moves; }
+	~Tracked() { --alive; }
+	Tracked& operator=(const Tracked& other) { value = other.value; ++copies; return *this; }
+	Tracked& operator=(Tracked&& other) { value = other.value; ++moves; return *this; }
+};
+int Tracked::alive;
+int Tracked::copies;
+int Tracked::moves;
+
+struct a_raw_memory_queue {};
+
+TEST(a_raw_memory_queue, constructs_in_place)
+{
+	Tracked::alive = 0;
+	Tracked::copies = 0;
+	{
+		dyplo::RawMemoryQueue<Tracked, dyplo::NoopScheduler> q(3);
+		YAFFUT_EQUAL(0, Tracked::alive);
+		for (int round = 0; round < 5; ++round)
+		{
+			q.emplace(round);
+			q.push_one(Tracked(round + 10));
+			YAFFUT_EQUAL(2, Tracked::alive);
+			YAFFUT_EQUAL(round, q.pop_one().value);
+			YAFFUT_EQUAL(round + 10, q.pop_one().value);
+			YAFFUT_EQUAL(0, Tracked::alive);
+		}
+		q.emplace(42);
+		q.emplace(43);
+		YAFFUT_EQUAL(2, Tracked::alive);
+	}
+	/* Remaining elements destroyed with the queue */
+	YAFFUT_EQUAL(0, Tracked::alive);
+	YAFFUT_EQUAL(0, Tracked::copies);
+}
+
+TEST(a_raw_memory_queue, strings)
+{
+	dyplo::RawMemoryQueue<std::string, dyplo::NoopScheduler> q(2);
+	std::string text(100, 'x');
+	const char* storage = text.data();
+	q.push_one(std::move(text));
+	std::string result = q.pop_one();
+	YAFFUT_EQUAL(storage, result.data()); /* Same heap buffer */
+	q.emplace(5, 'y');
+	YAFFUT_EQUAL("yyyyy", q.pop_one());
+}
+
+TEST(a_fixed_memory_queue, moves_elements)
+{
+	dyplo::FixedMemoryQueue<std::string, dyplo::NoopScheduler> q(2);
+	std::string text(100, 'x');
+	const char* storage = text.data();
+	q.push_one(std::move(text));
+	YAFFUT_EQUAL(storage, q.pop_one().data());
+}
+
 struct a_single_queue {};
 TEST(a_single_queue, basic)
 {
@@ -438,3 +736,397 @@ TEST(a_file_queue, read_carry_only)
 	}
 	input.end_read(count);
 }
+
+struct a_shared_memory_queue {};
+
+TEST(a_shared_memory_queue, attach)
+{
+	dyplo::SharedMemoryQueue<int> writer(4);
+	dyplo::SharedMemoryQueue<int> reader(dyplo::File(::dup(writer.handle())));
+	EQUAL(4u, reader.capacity());
+	YAFFUT_CHECK(reader.empty());
+	int* data;
+	EQUAL(4u, writer.begin_write(data, 1));
+	data[0] = 1;
+	data[1] = 2;
+	data[2] = 3;
+	writer.end_write(3);
+	EQUAL(3u, reader.size());
+	int* result;
+	EQUAL(3u, reader.begin_read(result, 0));
+	EQUAL(2, result[1]);
+	reader.end_read(3);
+	/* Only one element left before wrapping */
+	EQUAL(1u, writer.begin_write(data, 0));
+	writer.push_one(4);
+	writer.push_one(5);
+	EQUAL(4, reader.pop_one());
+	EQUAL(5, reader.pop_one());
+	YAFFUT_CHECK(writer.empty());
+	/* Mismatching element type */
+	try
+	{
+		dyplo::SharedMemoryQueue<short> other(dyplo::File(::dup(writer.handle())));
+		FAIL("Attached with the wrong type");
+	}
+	catch (const std::runtime_error&)
+	{
+	}
+}
+
+struct WrappingSharedMemoryQueue: public dyplo::SharedMemoryQueue<int>
+{
+	WrappingSharedMemoryQueue(unsigned int capacity, uint32_t position):
+		dyplo::SharedMemoryQueue<int>(capacity)
+	{
+		m_control->written = position;
+		m_control->read = position;
+	}
+};
+
+TEST(a_shared_memory_queue, counters_wrap)
+{
+	/* 2^32 is not a multiple of 5 */
+	WrappingSharedMemoryQueue writer(5, UINT_MAX - 6);
+	EQUAL(8u, writer.capacity());
+	dyplo::SharedMemoryQueue<int> reader(dyplo::File(::dup(writer.handle())));
+	int next = 0;
+	int expected = 0;
+	for (unsigned int round = 0; round < 10; ++round)
+	{
+		int* data;
+		unsigned int count = writer.begin_write(data, 1);
+		if (count > 3)
+			count = 3;
+		for (unsigned int i = 0; i < count; ++i)
+			data[i] = next++;
+		writer.end_write(count);
+		while (!reader.empty())
+			EQUAL(expected++, reader.pop_one());
+	}
+	YAFFUT_CHECK(next > 20);
+	EQUAL(next, expected);
+}
+
+TEST(a_shared_memory_queue, interrupt_and_resume)
+{
+	dyplo::SharedMemoryQueue<int> q(2);
+	int* data;
+	q.interrupt_read();
+	try
+	{
+		q.begin_read(data, 1);
+		FAIL("Should have been interrupted");
+	}
+	catch (const dyplo::InterruptedException&)
+	{
+	}
+	q.resume_read();
+	EQUAL(0u, q.begin_read(data, 0));
+	q.push_one(1);
+	q.push_one(2);
+	q.interrupt_write();
+	try
+	{
+		q.begin_write(data, 1);
+		FAIL("Should have been interrupted");
+	}
+	catch (const dyplo::InterruptedException&)
+	{
+	}
+	q.resume_write();
+	EQUAL(1, q.pop_one());
+	q.push_one(3);
+}
+
+TEST(a_shared_memory_queue, between_processes)
+{
+	const int count = 100000;
+	dyplo::SharedMemoryQueue<int> q(16);
+	pid_t child = ::fork();
+	YAFFUT_CHECK(child >= 0);
+	if (child == 0)
+	{
+		/* Writer in the child, in blocks that wrap around */
+		int i = 0;
+		while (i < count)
+		{
+			int* data;
+			unsigned int n = q.begin_write(data, 1);
+			if (n > 3)
+				n = 3;
+			unsigned int j = 0;
+			for (; j < n && i < count; ++j)
+				data[j] = i++;
+			q.end_write(j);
+		}
+		::_exit(0);
+	}
+	int expected = 0;
+	while (expected < count)
+	{
+		int* data;
+		unsigned int n = q.begin_read(data, 1);
+		for (unsigned int j = 0; j < n; ++j)
+		{
+			if (data[j] != expected)
+				FAIL("Out of sequence");
+			++expected;
+		}
+		q.end_read(n);
+	}
+	int status;
+	EQUAL(child, ::waitpid(child, &status, 0));
+	YAFFUT_CHECK(WIFEXITED(status));
+	EQUAL(0, WEXITSTATUS(status));
+}
+
+struct a_socket_queue {};
+
+TEST(a_socket_queue, tcp_loopback)
+{
+	dyplo::File listener(dyplo::tcp_listen(0, "127.0.0.1"));
+	dyplo::File client(dyplo::tcp_connect("127.0.0.1", dyplo::socket_port(listener)));
+	dyplo::File server(dyplo::socket_accept(listener));
+	dyplo::FilePollScheduler scheduler;
+	dyplo::SocketOutputQueue<int> output(scheduler, client, 64, 16);
+	dyplo::SocketInputQueue<int> input(scheduler, server, 64);
+	int* data;
+	/* Nothing is sent until a batch is complete */
+	for (int i = 0; i < 10; ++i)
+		output.push_one(i);
+	EQUAL(10u, output.size());
+	EQUAL(0u, input.begin_read(data, 0));
+	for (int i = 10; i < 1000; ++i)
+		output.push_one(i);
+	output.flush();
+	EQUAL(0u, output.size());
+	for (int i = 0; i < 1000; ++i)
+		EQUAL(i, input.pop_one());
+}
+
+TEST(a_socket_queue, sends_each_write_by_default)
+{
+	dyplo::File listener(dyplo::tcp_listen(0, "127.0.0.1"));
+	dyplo::File client(dyplo::tcp_connect("127.0.0.1", dyplo::socket_port(listener)));
+	dyplo::File server(dyplo::socket_accept(listener));
+	dyplo::FilePollScheduler scheduler;
+	dyplo::SocketOutputQueue<int> output(scheduler, client, 64);
+	dyplo::SocketInputQueue<int> input(scheduler, server, 64);
+	/* A request/reply exchange must not stall without flush */
+	for (int i = 0; i < 10; ++i)
+	{
+		output.push_one(i);
+		EQUAL(0u, output.size());
+		EQUAL(i, input.pop_one());
+	}
+}
+
+TEST(a_socket_queue, unix_end_of_input)
+{
+	char path[] = "/tmp/dyplotestXXXXXX";
+	YAFFUT_CHECK(::mkdtemp(path) != NULL);
+	std::string name = std::string(path) + "/socket";
+	dyplo::FilePollScheduler scheduler;
+	{
+		dyplo::File listener(dyplo::unix_listen(name.c_str()));
+		dyplo::File server(dyplo::unix_connect(name.c_str()));
+		{
+			dyplo::File client(dyplo::socket_accept(listener));
+			dyplo::SocketOutputQueue<int> output(scheduler, client, 8);
+			int* data;
+			EQUAL(8u, output.begin_write(data, 1));
+			data[0] = 42;
+			data[1] = 43;
+			output.end_write(2);
+			output.flush();
+		}
+		dyplo::SocketInputQueue<int> input(scheduler, server, 8);
+		EQUAL(42, input.pop_one());
+		EQUAL(43, input.pop_one());
+		try
+		{
+			input.pop_one();
+			FAIL("Expected end of input");
+		}
+		catch (const dyplo::EndOfInputException&)
+		{
+		}
+	}
+	::unlink(name.c_str());
+	::rmdir(path);
+}
+
+TEST(a_socket_queue, udp_drops_oversized)
+{
+	dyplo::File receiver(dyplo::udp_bind(0, "127.0.0.1"));
+	dyplo::File sender(dyplo::udp_connect("127.0.0.1", dyplo::socket_port(receiver)));
+	dyplo::FilePollScheduler scheduler;
+	dyplo::DatagramOutputQueue<int> output(scheduler, sender, 16);
+	dyplo::DatagramInputQueue<int> input(scheduler, receiver, 8);
+	int* data;
+	EQUAL(16u, output.begin_write(data, 1));
+	for (int i = 0; i < 4; ++i)
+		data[i] = i;
+	output.end_write(4);
+	/* Too large for the reader */
+	output.begin_write(data, 1);
+	output.end_write(12);
+	output.begin_write(data, 1);
+	for (int i = 0; i < 6; ++i)
+		data[i] = 10 + i;
+	output.end_write(6);
+	EQUAL(4u, input.begin_read(data, 1));
+	EQUAL(3, data[3]);
+	input.end_read(2);
+	/* The next datagram does not fit behind the remaining two */
+	EQUAL(2u, input.begin_read(data, 2));
+	input.end_read(2);
+	EQUAL(6u, input.begin_read(data, 6));
+	EQUAL(10, data[0]);
+	EQUAL(15, data[5]);
+	input.end_read(6);
+	EQUAL(1u, input.dropped());
+	EQUAL(0u, output.dropped());
+	input.interrupt_read();
+	try
+	{
+		input.begin_read(data, 1);
+		FAIL("Should have been interrupted");
+	}
+	catch (const dyplo::InterruptedException&)
+	{
+	}
+}
+
+struct an_arena {};
+
+TEST(an_arena, allocates_aligned)
+{
+	dyplo::Arena arena(10000);
+	YAFFUT_CHECK(arena.size() >= 10000);
+	char* a = (char*)arena.allocate(1);
+	char* b = (char*)arena.allocate(100);
+	EQUAL(0u, ((size_t)a) % dyplo::Arena::cache_line_size);
+	EQUAL((size_t)dyplo::Arena::cache_line_size, (size_t)(b - a));
+	EQUAL(dyplo::Arena::cache_line_size + 100, arena.used());
+	try
+	{
+		arena.allocate(arena.available() + 1, 1);
+		FAIL("Arena should be exhausted");
+	}
+	catch (const std::bad_alloc&)
+	{
+	}
+	/* Still usable after a failure */
+	arena.allocate(arena.available(), 1);
+	EQUAL(0u, arena.available());
+}
+
+TEST(an_arena, holds_queues_and_objects)
+{
+	dyplo::Arena arena(1 << 20, true);
+	{
+		dyplo::FixedMemoryQueue<std::string, dyplo::NoopScheduler> q(arena, 4);
+		q.push_one("one");
+		q.push_one("two");
+		EQUAL("one", q.pop_one());
+		dyplo::RawMemoryQueue<Tracked, dyplo::NoopScheduler> raw(arena, 4);
+		raw.emplace(1);
+		EQUAL(1, Tracked::alive);
+		Tracked* tracked = new (arena) Tracked(2);
+		EQUAL(2, Tracked::alive);
+		dyplo::Arena::destroy(tracked);
+		EQUAL(1, Tracked::alive);
+	}
+	EQUAL(0, Tracked::alive);
+	dyplo::Pipe p;
+	dyplo::FilePollScheduler scheduler;
+	dyplo::FileOutputQueue<int> output(arena, scheduler, p.write_handle(), 10);
+	dyplo::FileInputQueue<int> input(arena, scheduler, p.read_handle(), 10);
+	output.push_one(7);
+	EQUAL(7, input.pop_one());
+	dyplo::File receiver(dyplo::udp_bind(0, "127.0.0.1"));
+	dyplo::File sender(dyplo::udp_connect("127.0.0.1", dyplo::socket_port(receiver)));
+	dyplo::DatagramOutputQueue<int> datagram_output(arena, scheduler, sender, 10);
+	dyplo::DatagramInputQueue<int> datagram_input(arena, scheduler, receiver, 10);
+	datagram_output.push_one(8);
+	EQUAL(8, datagram_input.pop_one());
+	YAFFUT_CHECK(arena.used() >= 4 * sizeof(std::string) + 4 * sizeof(Tracked) + 40 * sizeof(int));
+}
+
+struct realtime_memory {};
+
+TEST(realtime_memory, locks_buffers)
+{
+	const size_t before = dyplo::RealtimeMemory::locked();
+	{
+		/* Disabled by default */
+		dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> q(1000);
+		EQUAL(before, dyplo::RealtimeMemory::locked());
+	}
+	dyplo::RealtimeMemory::enable(16 * 1024);
+	YAFFUT_CHECK(dyplo::RealtimeMemory::enabled());
+	{
+		dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> q(1000);
+		const size_t queue_locked = dyplo::RealtimeMemory::locked() - before;
+		YAFFUT_CHECK(queue_locked >= 1000 * sizeof(int));
+		dyplo::Arena arena(100000);
+		EQUAL(before + queue_locked + arena.size(), dyplo::RealtimeMemory::locked());
+		/* Already locked with the arena */
+		dyplo::FixedMemoryQueue<int, dyplo::NoopScheduler> q2(arena, 1000);
+		EQUAL(before + queue_locked + arena.size(), dyplo::RealtimeMemory::locked());
+		dyplo::File socket(dyplo::udp_bind(0, "127.0.0.1"));
+		dyplo::FilePollScheduler scheduler;
+		dyplo::DatagramInputQueue<int> datagram_input(scheduler, socket, 1000);
+		YAFFUT_CHECK(dyplo::RealtimeMemory::locked() >= before + queue_locked + arena.size() + 1000 * sizeof(int));
+		/* Each kind of queue locks its buffer */
+		size_t locked = dyplo::RealtimeMemory::locked();
+		dyplo::BroadcastQueue<int, dyplo::NoopScheduler> broadcast(1024, 2);
+		YAFFUT_CHECK(dyplo::RealtimeMemory::locked() >= locked + 1024 * sizeof(int));
+		locked = dyplo::RealtimeMemory::locked();
+		dyplo::FrameQueue<dyplo::NoopScheduler> frames(8192);
+		YAFFUT_CHECK(dyplo::RealtimeMemory::locked() >= locked + 8192);
+		locked = dyplo::RealtimeMemory::locked();
+		dyplo::SharedMemoryQueue<int> shared(1024);
+		YAFFUT_CHECK(dyplo::RealtimeMemory::locked() >= locked + 1024 * sizeof(int));
+		YAFFUT_CHECK(dyplo::RealtimeMemory::prepare_thread() >= 16 * 1024);
+	}
+	dyplo::RealtimeMemory::disable();
+	EQUAL(0u, dyplo::RealtimeMemory::prepare(&before, sizeof(before)));
+}
+
+struct StackReserve
+{
+	size_t reserved;
+	size_t stack_size;
+};
+
+static void* prepare_small_stack(void* arg)
+{
+	StackReserve* result = (StackReserve*)arg;
+	result->reserved = dyplo::RealtimeMemory::prepare_thread();
+	pthread_attr_t attr;
+	void* stack_address;
+	pthread_getattr_np(pthread_self(), &attr);
+	pthread_attr_getstack(&attr, &stack_address, &result->stack_size);
+	pthread_attr_destroy(&attr);
+	return NULL;
+}
+
+TEST(realtime_memory, limits_stack_reserve)
+{
+	/* Reserve more than the thread's stack holds */
+	dyplo::RealtimeMemory::enable(1024 * 1024);
+	dyplo::ThreadAttributes attributes;
+	attributes.stack_size = 64 * 1024;
+	StackReserve result;
+	dyplo::Thread thread;
+	EQUAL(0, thread.start(prepare_small_stack, &result, attributes));
+	EQUAL(0, thread.join());
+	dyplo::RealtimeMemory::disable();
+	/* The thread may get a larger stack than asked for */
+	YAFFUT_CHECK(result.stack_size < 1024 * 1024);
+	YAFFUT_CHECK(result.reserved > 0);
+	YAFFUT_CHECK(result.reserved < result.stack_size);
+}
@@ -135,35 +135,34 @@ struct Stress
 		unsigned int candidates = context.getAvailablePartitions(function_name);
 		if ((candidates == 0) && nodes.empty())
 			FAIL("No testNode available");
-		control.disableNodes(candidates);
+		dyplo::HardwareProgrammingSession session(context, control);
+		unsigned int mask = 1;
+		for (int id = 1; id < 32; ++id)
 		{
-			dyplo::HardwareProgrammer programmer(context, control);
-			unsigned int mask = 1;
-			for (int id = 1; id < 32; ++id)
+			mask <<= 1;
+			if ((mask & candidates) != 0)
 			{
-				mask <<= 1;
-				if ((mask & candidates) != 0)
+				int handle = context.openConfig(id, O_RDWR);
+				if (handle == -1)
 				{
-					int handle = context.openConfig(id, O_RDWR);
-					if (handle == -1)
-					{
-						if (errno != EBUSY) /* Non existent? Bail out, last node */
-							break;
-					}
-					else
+					if (errno != EBUSY) /* Non existent? Bail out, last node */
+						break;
+				}
+				else
+				{
+					if (!session.add(function_name, id))
 					{
-						std::string filename =
-								context.findPartition(function_name, id);
-						programmer.fromFile(filename.c_str());
-						//std::cerr << __func__ << " handle=" << handle << " id=" << id << std::endl;
-						nodes.push_back(new StressNode(id, handle));
+						::close(handle);
+						continue; /* No bitstream for this node */
 					}
+					//std::cerr << __func__ << " handle=" << handle << " id=" << id << std::endl;
+					nodes.push_back(new StressNode(id, handle));
 				}
 			}
 		}
-		/* Enabling nodes must be postponed until AFTER closing the
-		 * programmer object. */
-		control.enableNodes(candidates);
+		/* Disables the nodes, programs them in one go and enables
+		 * them again after the final flush. */
+		session.execute();
 		std::cout << " (" << nodes.size() << " nodes)";
 	}
 
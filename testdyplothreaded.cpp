@@ -26,6 +26,7 @@
  * You can contact Topic by electronic mail via info@topic.nl or via
  * paper mail at the following address: Postbus 440, 5680 AK Best, The Netherlands.
  */
+#include <unistd.h>
 #include "threadedprocess.hpp"
 
 #include "yaffut.h"
@@ -159,6 +160,467 @@ TEST(threading_scheduler, multi_stages)
   	YAFFUT_EQUAL(68, output_from_c.pop_one());
 }
 
+template <class T, int raise> void process_add_constant(T* dest, T* src, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+		*dest++ = (*src++) + raise;
+}
+
+TEST(threading_scheduler, begin_read_deadline)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> q(4);
+	int* data;
+	struct timespec deadline;
+	dyplo::monotonic_deadline(deadline, 1000);
+	YAFFUT_EQUAL(0u, q.begin_read(data, 1, deadline));
+	q.push_one(1);
+	dyplo::monotonic_deadline(deadline, 1000);
+	YAFFUT_EQUAL(1u, q.begin_read(data, 2, deadline));
+	q.push_one(2);
+	YAFFUT_EQUAL(2u, q.begin_read(data, 2, deadline));
+}
+
+TEST(threading_scheduler, watermark_trickle)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(16);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(16);
+	output_from_a.set_read_watermark(8, 2000);
+	AddFive<int, 1> proc;
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+	/* Far below the watermark, and the writer never flushes */
+	for (int i = 0; i < 3; ++i)
+	{
+		input_to_a.push_one(i);
+		YAFFUT_EQUAL(i + 5, output_from_a.pop_one());
+	}
+}
+
+TEST(threading_scheduler, deadline_process)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(16);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(16);
+	dyplo::ThreadedDeadlineProcess<
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		process_add_constant<int, 5>, 8> proc(2000);
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+
+	/* A partial block comes out once the deadline expires */
+	input_to_a.push_one(10);
+	input_to_a.push_one(11);
+	YAFFUT_EQUAL(15, output_from_a.pop_one());
+	YAFFUT_EQUAL(16, output_from_a.pop_one());
+	/* Full blocks still work */
+	for (int i = 0; i < 16; ++i)
+		input_to_a.push_one(20 + i);
+	for (int i = 0; i < 16; ++i)
+		YAFFUT_EQUAL(25 + i, output_from_a.pop_one());
+}
+
+TEST(threading_scheduler, dynamic_process)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(8);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(3);
+	dyplo::ThreadedDynamicProcess<
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		process_add_constant<int, 5> > proc;
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+
+	int* data;
+	YAFFUT_EQUAL(8u, input_to_a.begin_write(data, 8));
+	for (int i = 0; i < 8; ++i)
+		data[i] = 30 + i;
+	input_to_a.end_write(8);
+	/* Output is smaller than the input */
+	for (int i = 0; i < 8; ++i)
+		YAFFUT_EQUAL(35 + i, output_from_a.pop_one());
+	input_to_a.push_one(1);
+	YAFFUT_EQUAL(6, output_from_a.pop_one());
+}
+
+/* Takes a different amount of time for each block, so that workers
+ * finish out of order */
+static void process_block_slow_square(int* dest, int* src)
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		usleep(((src[i] * 7) % 5) * 200);
+		dest[i] = src[i] * src[i];
+	}
+}
+
+TEST(threading_scheduler, parallel_process_keeps_order)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(256);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(4);
+	dyplo::ParallelProcess<
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		process_block_slow_square, 2> proc(4);
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+
+	for (int i = 0; i < 200; ++i)
+		input_to_a.push_one(i);
+	for (int i = 0; i < 200; ++i)
+		YAFFUT_EQUAL(i * i, output_from_a.pop_one());
+	/* Restart after terminate */
+	proc.terminate();
+	input_to_a.resume_read();
+	output_from_a.resume_write();
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+	input_to_a.push_one(3);
+	input_to_a.push_one(4);
+	YAFFUT_EQUAL(9, output_from_a.pop_one());
+	YAFFUT_EQUAL(16, output_from_a.pop_one());
+}
+
+TEST(threading_scheduler, threaded_process_failed_start)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(4);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(4);
+	{
+		AddFive<int> proc;
+		dyplo::ThreadAttributes attributes;
+		attributes.stack_size = 1; /* Too small, thread fails */
+		proc.set_thread_attributes(attributes);
+		proc.set_input(&input_to_a);
+		try
+		{
+			proc.set_output(&output_from_a);
+			FAIL("Should have failed to create a thread");
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+	}
+	/* Destroying the process must not have interrupted the queues */
+	input_to_a.push_one(1);
+	YAFFUT_EQUAL(1, input_to_a.pop_one());
+	output_from_a.push_one(2);
+	YAFFUT_EQUAL(2, output_from_a.pop_one());
+}
+
+TEST(threading_scheduler, parallel_process_failed_start)
+{
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> input_to_a(16);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_from_a(16);
+	dyplo::ParallelProcess<
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		process_block_slow_square, 2> proc(3);
+	std::vector<dyplo::ThreadAttributes> attributes(2);
+	attributes[1].stack_size = 1; /* Too small, second worker fails */
+	proc.set_thread_attributes(attributes);
+	proc.set_input(&input_to_a);
+	try
+	{
+		proc.set_output(&output_from_a);
+		FAIL("Should have failed to create a thread");
+	}
+	catch (const std::runtime_error&)
+	{
+	}
+	/* The first worker must have been stopped */
+	input_to_a.resume_read();
+	output_from_a.resume_write();
+	input_to_a.push_one(2);
+	input_to_a.push_one(3);
+	usleep(10000);
+	YAFFUT_EQUAL(2u, input_to_a.size());
+	YAFFUT_CHECK(output_from_a.empty());
+	/* Works after fixing the attributes */
+	proc.set_thread_attributes(std::vector<dyplo::ThreadAttributes>());
+	proc.set_input(&input_to_a);
+	proc.set_output(&output_from_a);
+	YAFFUT_EQUAL(4, output_from_a.pop_one());
+	YAFFUT_EQUAL(9, output_from_a.pop_one());
+}
+
+#include "mpmcqueue.hpp"
+
+typedef dyplo::MPMCQueue<int, dyplo::PthreadScheduler> IntMPMCQueue;
+
+struct mpmc_queue {};
+
+TEST(mpmc_queue, single_thread)
+{
+	IntMPMCQueue q(3);
+	YAFFUT_EQUAL(4u, q.capacity());
+	int* data;
+	YAFFUT_EQUAL(0u, q.begin_read(data, 0));
+	q.end_read(0);
+	q.push_one(1);
+	YAFFUT_EQUAL(1u, q.begin_write(data, 1));
+	q.end_write(0); /* Cancelled, skipped by the reader */
+	q.push_one(2);
+	q.push_one(3);
+	YAFFUT_EQUAL(0u, q.begin_write(data, 0)); /* Full */
+	q.end_write(0); /* Allowed, like with the other queues */
+	YAFFUT_EQUAL(1, q.pop_one());
+	YAFFUT_EQUAL(2, q.pop_one());
+	YAFFUT_EQUAL(1u, q.begin_read(data, 1));
+	YAFFUT_EQUAL(3, *data);
+	q.end_read(1);
+	YAFFUT_CHECK(q.empty());
+}
+
+TEST(mpmc_queue, locks_cells)
+{
+	dyplo::RealtimeMemory::enable(0);
+	const size_t before = dyplo::RealtimeMemory::locked();
+	{
+		IntMPMCQueue q(1024);
+		YAFFUT_CHECK(dyplo::RealtimeMemory::locked() >= before + 1024 * sizeof(int));
+	}
+	dyplo::RealtimeMemory::disable();
+}
+
+TEST(mpmc_queue, reservation_limit)
+{
+	const unsigned int count = dyplo::MPMCReservations::max_queues + 1;
+	IntMPMCQueue* queues[count];
+	for (unsigned int i = 0; i < count; ++i)
+		queues[i] = new IntMPMCQueue(2);
+	int* data;
+	for (unsigned int i = 0; i < dyplo::MPMCReservations::max_queues; ++i)
+		YAFFUT_EQUAL(1u, queues[i]->begin_write(data, 1));
+	IntMPMCQueue* extra = queues[count - 1];
+	try
+	{
+		extra->begin_write(data, 1);
+		FAIL("Should have run out of reservations");
+	}
+	catch (const std::logic_error&)
+	{
+	}
+	/* No slot was taken from the extra queue */
+	YAFFUT_CHECK(extra->empty());
+	queues[0]->end_write(1);
+	extra->push_one(5);
+	YAFFUT_EQUAL(5, extra->pop_one());
+	for (unsigned int i = 1; i < dyplo::MPMCReservations::max_queues; ++i)
+		queues[i]->end_write(0);
+	for (unsigned int i = 0; i < count; ++i)
+		delete queues[i];
+}
+
+struct MPMCProducer
+{
+	IntMPMCQueue* queue;
+	int first;
+	int count;
+	dyplo::Thread thread;
+
+	static void* run(void* arg)
+	{
+		MPMCProducer* self = (MPMCProducer*)arg;
+		for (int i = 0; i < self->count; ++i)
+			self->queue->push_one(self->first + i);
+		return NULL;
+	}
+};
+
+struct MPMCConsumer
+{
+	IntMPMCQueue* queue;
+	long long sum;
+	int count;
+	bool ordered;
+	dyplo::Thread thread;
+
+	static void* run(void* arg)
+	{
+		MPMCConsumer* self = (MPMCConsumer*)arg;
+		int last[4] = {-1, -1, -1, -1};
+		try
+		{
+			for (;;)
+			{
+				int value = self->queue->pop_one();
+				/* Elements of one producer arrive in order */
+				if (value <= last[value / 1000000])
+					self->ordered = false;
+				last[value / 1000000] = value;
+				self->sum += value;
+				++self->count;
+			}
+		}
+		catch (const dyplo::InterruptedException&)
+		{
+		}
+		return NULL;
+	}
+};
+
+TEST(mpmc_queue, many_producers_and_consumers)
+{
+	const int per_producer = 20000;
+	IntMPMCQueue q(16);
+	MPMCProducer producers[4];
+	MPMCConsumer consumers[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		consumers[i].queue = &q;
+		consumers[i].sum = 0;
+		consumers[i].count = 0;
+		consumers[i].ordered = true;
+		consumers[i].thread.start(&MPMCConsumer::run, &consumers[i]);
+	}
+	long long expected = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		producers[i].queue = &q;
+		producers[i].first = i * 1000000;
+		producers[i].count = per_producer;
+		for (int j = 0; j < per_producer; ++j)
+			expected += producers[i].first + j;
+		producers[i].thread.start(&MPMCProducer::run, &producers[i]);
+	}
+	for (int i = 0; i < 4; ++i)
+		producers[i].thread.join();
+	while (!q.empty())
+		usleep(1000);
+	q.interrupt_read();
+	long long sum = 0;
+	int count = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		consumers[i].thread.join();
+		sum += consumers[i].sum;
+		count += consumers[i].count;
+		YAFFUT_CHECK(consumers[i].ordered);
+	}
+	YAFFUT_EQUAL(4 * per_producer, count);
+	YAFFUT_EQUAL(expected, sum);
+}
+
+#include "broadcastqueue.hpp"
+
+TEST(threading_scheduler, broadcast_to_processes)
+{
+	typedef dyplo::BroadcastQueue<int, dyplo::PthreadScheduler> Broadcast;
+	Broadcast input(4, 3);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_a(64);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_b(64);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler> output_c(64);
+	dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>* outputs[3] = {&output_a, &output_b, &output_c};
+	dyplo::ThreadedProcess<Broadcast::Reader,
+		dyplo::FixedMemoryQueue<int, dyplo::PthreadScheduler>,
+		process_block_add_constant<int, 5, 1> > procs[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		procs[i].set_input(&input.reader(i));
+		procs[i].set_output(outputs[i]);
+	}
+	for (int i = 0; i < 50; ++i)
+		input.push_one(i);
+	for (int p = 0; p < 3; ++p)
+		for (int i = 0; i < 50; ++i)
+			YAFFUT_EQUAL(i + 5, outputs[p]->pop_one());
+	for (int i = 0; i < 3; ++i)
+		procs[i].terminate();
+}
+
+#include "cputopology.hpp"
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+struct cpu_topology {};
+
+TEST(cpu_topology, parse_cpu_list)
+{
+	std::vector<int> cpus;
+	dyplo::parse_cpu_list("0-2,5,7-8\n", cpus);
+	YAFFUT_EQUAL(6u, cpus.size());
+	YAFFUT_EQUAL(0, cpus[0]);
+	YAFFUT_EQUAL(2, cpus[2]);
+	YAFFUT_EQUAL(5, cpus[3]);
+	YAFFUT_EQUAL(8, cpus[5]);
+}
+
+static void write_sysfs(const std::string& path, const char* contents)
+{
+	std::string::size_type slash = 0;
+	while ((slash = path.find('/', slash + 1)) != std::string::npos)
+		::mkdir(path.substr(0, slash).c_str(), 0755);
+	std::ofstream file(path.c_str());
+	file << contents << "\n";
+}
+
+TEST(cpu_topology, clusters_from_sysfs)
+{
+	/* Two clusters of two CPUs, interleaved numbering, CPU 3 offline */
+	char root[] = "/tmp/dyplotopologyXXXXXX";
+	YAFFUT_CHECK(::mkdtemp(root) != NULL);
+	const std::string cpu(std::string(root) + "/cpu");
+	write_sysfs(cpu + "/online", "0-2,4");
+	const char* l2[] = {"0,2", "1,3,4", "0,2", "", "1,3,4"};
+	for (int i = 0; i < 5; ++i)
+	{
+		char number[16];
+		sprintf(number, "%d", i);
+		const std::string cache(cpu + "/cpu" + number + "/cache/index");
+		write_sysfs(cache + "0/level", "1");
+		write_sysfs(cache + "0/shared_cpu_list", number);
+		if (i == 3)
+			continue;
+		write_sysfs(cache + "1/level", "2");
+		write_sysfs(cache + "1/shared_cpu_list", l2[i]);
+	}
+	dyplo::CpuTopology topology(cpu.c_str());
+	YAFFUT_EQUAL(4u, topology.cpus().size());
+	YAFFUT_EQUAL(2u, topology.cache_siblings(1).size());
+	YAFFUT_EQUAL(4, topology.cache_siblings(1)[1]);
+	std::vector<int> placement = topology.place_pipeline(5);
+	YAFFUT_EQUAL(0, placement[0]);
+	YAFFUT_EQUAL(2, placement[1]);
+	YAFFUT_EQUAL(1, placement[2]);
+	YAFFUT_EQUAL(4, placement[3]);
+	YAFFUT_EQUAL(0, placement[4]);
+	std::vector<int> irq_cpus(1, 4);
+	std::vector<int> near = topology.near(irq_cpus);
+	YAFFUT_EQUAL(2u, near.size());
+	YAFFUT_EQUAL(1, near[0]);
+
+	write_sysfs(std::string(root) + "/interrupts",
+		"           CPU0       CPU1\n"
+		" 44:          0          0     GIC-0  61 Level     xilinx-dma\n"
+		" 45:         12          0     GIC-0  62 Level     dyplo");
+	write_sysfs(std::string(root) + "/irq/45/smp_affinity_list", "1");
+	YAFFUT_EQUAL(45, dyplo::CpuTopology::find_interrupt("dyplo", root));
+	YAFFUT_EQUAL(-1, dyplo::CpuTopology::find_interrupt("nothing", root));
+	YAFFUT_EQUAL(1u, dyplo::CpuTopology::interrupt_cpus(45, root).size());
+	std::string command("rm -rf ");
+	command += root;
+	YAFFUT_CHECK(system(command.c_str()) == 0);
+}
+
+static void* report_cpu(void* arg)
+{
+	*(int*)arg = sched_getcpu();
+	return NULL;
+}
+
+TEST(cpu_topology, thread_affinity)
+{
+	dyplo::CpuTopology topology;
+	dyplo::ThreadAttributes attributes;
+	attributes.cpus.push_back(topology.cpus().back());
+	int cpu = -1;
+	dyplo::Thread thread;
+	YAFFUT_EQUAL(0, thread.start(report_cpu, &cpu, attributes));
+	thread.join();
+	YAFFUT_EQUAL(topology.cpus().back(), cpu);
+}
+
 #include "cooperativescheduler.hpp"
 #include "cooperativeprocess.hpp"
 
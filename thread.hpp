@@ -28,10 +28,25 @@
  */
 #pragma once
 
+#include <vector>
+#include <sched.h>
 #include <pthread.h>
 
 namespace dyplo
 {
+	/* Placement and scheduling of a thread. The defaults give a
+	 * normal thread that may run on any CPU. Real-time policies
+	 * (SCHED_FIFO, SCHED_RR) usually need CAP_SYS_NICE. */
+	struct ThreadAttributes
+	{
+		std::vector<int> cpus;	/* Allowed CPUs, empty for all */
+		int policy;	/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+		int priority;	/* For SCHED_FIFO and SCHED_RR */
+		size_t stack_size;
+
+		ThreadAttributes();
+	};
+
 	class Thread
 	{
 	protected:
@@ -56,7 +71,40 @@ namespace dyplo
 			pthread_attr_t attr;
 			pthread_attr_init(&attr);
 			pthread_attr_setstacksize(&attr, default_stack_size);
-			return pthread_create(&m_thread, &attr, start_routine, arg);
+			int result = pthread_create(&m_thread, &attr, start_routine, arg);
+			pthread_attr_destroy(&attr);
+			return result;
+		}
+
+		/* Returns an error code like pthread_create, e.g. EPERM when
+		 * not allowed to use a real-time policy. */
+		int start(void *(*start_routine) (void *), void *arg, const ThreadAttributes& attributes)
+		{
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			int result = pthread_attr_setstacksize(&attr, attributes.stack_size);
+			if ((result == 0) && !attributes.cpus.empty())
+			{
+				cpu_set_t cpus;
+				CPU_ZERO(&cpus);
+				for (std::vector<int>::const_iterator it = attributes.cpus.begin(); it != attributes.cpus.end(); ++it)
+					CPU_SET(*it, &cpus);
+				result = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+			}
+			if ((result == 0) && (attributes.policy != SCHED_OTHER))
+			{
+				struct sched_param param;
+				param.sched_priority = attributes.priority;
+				result = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+				if (result == 0)
+					result = pthread_attr_setschedpolicy(&attr, attributes.policy);
+				if (result == 0)
+					result = pthread_attr_setschedparam(&attr, &param);
+			}
+			if (result == 0)
+				result = pthread_create(&m_thread, &attr, start_routine, arg);
+			pthread_attr_destroy(&attr);
+			return result;
 		}
 
 		int join(void **retval = NULL)
@@ -80,4 +128,11 @@ namespace dyplo
 			return m_thread;
 		}
 	};
+
+	inline ThreadAttributes::ThreadAttributes():
+		policy(SCHED_OTHER),
+		priority(0),
+		stack_size(Thread::default_stack_size)
+	{
+	}
 }
@@ -31,6 +31,8 @@
 #include "pthreadscheduler.hpp"
 #include "queue.hpp"
 #include "thread.hpp"
+#include "realtimememory.hpp"
+#include <algorithm>
 
 namespace dyplo
 {
@@ -42,6 +44,7 @@ namespace dyplo
 		OutputQueueClass *output;
 		Processor m_processor;
 		Thread m_thread;
+		ThreadAttributes m_thread_attributes;
 	public:
 		typedef typename InputQueueClass::Element InputElement;
 		typedef typename OutputQueueClass::Element OutputElement;
@@ -57,8 +60,8 @@ namespace dyplo
 		ThreadedProcessBase(const Processor& processor):
 			input(NULL),
 			output(NULL),
-			m_thread(),
-			m_processor(processor)
+			m_processor(processor),
+			m_thread()
 		{
 		}
 
@@ -96,6 +99,12 @@ namespace dyplo
 				start();
 		}
 
+		/* Applies to threads started after this call */
+		void set_thread_attributes(const ThreadAttributes& value)
+		{
+			m_thread_attributes = value;
+		}
+
 		void process()
 		{
 			try
@@ -111,11 +120,18 @@ namespace dyplo
 	private:
 		void start()
 		{
-			m_thread.start(&run, this);
+			if (m_thread.start(&run, this, m_thread_attributes) != 0)
+			{
+				/* Nothing to interrupt or join in terminate() */
+				input = NULL;
+				output = NULL;
+				throw std::runtime_error("Failed to create thread");
+			}
 		}
 
 		static void* run(void* arg)
 		{
+			RealtimeMemory::prepare_thread();
 			((ThreadedProcessBase*)arg)->process();
 			return 0;
 		}
@@ -154,6 +170,85 @@ namespace dyplo
 	};
 
 
+	/* Processes all elements that are available in the input queue and
+	 * fit in the output queue in one go, which saves the locking and
+	 * triggering per block. ProcessFunction is called with the number
+	 * of elements, which differs from call to call. */
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*, unsigned int)
+	> class DynamicProcessor
+	{
+	public:
+		typedef typename InputQueueClass::Element InputElement;
+		typedef typename OutputQueueClass::Element OutputElement;
+
+		void process(InputQueueClass* input, OutputQueueClass* output)
+		{
+			InputElement *src;
+			OutputElement *dest;
+			for(;;)
+			{
+				unsigned int count = input->begin_read(src, 1);
+				unsigned int room = output->begin_write(dest, 1);
+				if (count > room)
+					count = room;
+				ProcessFunction(dest, src, count);
+				output->end_write(count);
+				input->end_read(count);
+			}
+		}
+	};
+
+	/* Processes blocks of up to "blocksize" elements, but never holds
+	 * back elements for longer than max_latency_us. Once the first
+	 * element of a block arrives, it waits at most that long for the
+	 * rest, and then processes what it has. ProcessFunction receives
+	 * the actual number of elements. The input queue must support
+	 * begin_read with a deadline, e.g. FixedMemoryQueue with the
+	 * PthreadScheduler. */
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*, unsigned int),
+		int blocksize
+	> class DeadlineProcessor
+	{
+	public:
+		typedef typename InputQueueClass::Element InputElement;
+		typedef typename OutputQueueClass::Element OutputElement;
+
+		DeadlineProcessor(unsigned int max_latency_us = 1000):
+			m_max_latency_us(max_latency_us)
+		{
+		}
+
+		void process(InputQueueClass* input, OutputQueueClass* output)
+		{
+			InputElement *src;
+			OutputElement *dest;
+			for(;;)
+			{
+				input->begin_read(src, 1);
+				struct timespec deadline;
+				monotonic_deadline(deadline, m_max_latency_us);
+				unsigned int count = input->begin_read(src, blocksize, deadline);
+				DEBUG_ASSERT(count >= 1, "invalid value from begin_read");
+				if (count > (unsigned int)blocksize)
+					count = blocksize;
+#ifdef _DEBUG
+				unsigned int room =
+#endif
+					output->begin_write(dest, count);
+				DEBUG_ASSERT(room >= count, "invalid value from begin_write");
+				ProcessFunction(dest, src, count);
+				output->end_write(count);
+				input->end_read(count);
+			}
+		}
+
+		unsigned int max_latency_us() const { return m_max_latency_us; }
+	protected:
+		unsigned int m_max_latency_us;
+	};
+
 	template <class InputQueueClass, class OutputQueueClass,
 		void(*ProcessBlockFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*),
 		int blocksize = 1>
@@ -164,4 +259,210 @@ namespace dyplo
 	{
 	};
 
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*, unsigned int)>
+	class ThreadedDynamicProcess:
+		public ThreadedProcessBase<InputQueueClass, OutputQueueClass,
+			DynamicProcessor<InputQueueClass, OutputQueueClass, ProcessFunction>
+		>
+	{
+	};
+
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*, unsigned int),
+		int blocksize>
+	class ThreadedDeadlineProcess:
+		public ThreadedProcessBase<InputQueueClass, OutputQueueClass,
+			DeadlineProcessor<InputQueueClass, OutputQueueClass, ProcessFunction, blocksize>
+		>
+	{
+	public:
+		ThreadedDeadlineProcess(unsigned int max_latency_us):
+			ThreadedProcessBase<InputQueueClass, OutputQueueClass,
+				DeadlineProcessor<InputQueueClass, OutputQueueClass, ProcessFunction, blocksize>
+			>(DeadlineProcessor<InputQueueClass, OutputQueueClass, ProcessFunction, blocksize>(max_latency_us))
+		{
+		}
+	};
+
+	/* Runs "workers" copies of ProcessBlockFunction on their own threads.
+	 * Each worker takes the next input block, processes it, and waits
+	 * for its turn to write the result, so the output is in the same
+	 * order as with a single ThreadedProcess. The function must not
+	 * keep state between blocks. Blocks being processed are copied to
+	 * the worker, and are lost when the process is terminated. When a
+	 * worker thread cannot be created, the workers already running are
+	 * stopped like in terminate() before the exception is thrown. */
+	template <class InputQueueClass, class OutputQueueClass,
+		void(*ProcessBlockFunction)(typename OutputQueueClass::Element*, typename InputQueueClass::Element*),
+		int blocksize = 1>
+	class ParallelProcess
+	{
+	public:
+		typedef typename InputQueueClass::Element InputElement;
+		typedef typename OutputQueueClass::Element OutputElement;
+
+		ParallelProcess(unsigned int workers):
+			input(NULL),
+			output(NULL),
+			m_worker_count(workers),
+			m_workers(new Worker[workers]),
+			m_next_ticket(0),
+			m_next_output(0),
+			m_terminating(false)
+		{
+			for (unsigned int i = 0; i < m_worker_count; ++i)
+				m_workers[i].owner = this;
+		}
+
+		~ParallelProcess()
+		{
+			terminate();
+			delete [] m_workers;
+		}
+
+		void terminate()
+		{
+			if ((input != NULL) && (output != NULL))
+				stop(m_worker_count);
+			input = NULL;
+			output = NULL;
+		}
+
+		void set_input(InputQueueClass *value)
+		{
+			input = value;
+			if (input && output)
+				start();
+		}
+
+		void set_output(OutputQueueClass *value)
+		{
+			output = value;
+			if (input && output)
+				start();
+		}
+
+		/* Applies to workers started after this call. Pass one
+		 * attributes per worker, or a single one for all. */
+		void set_thread_attributes(const std::vector<ThreadAttributes>& value)
+		{
+			m_thread_attributes = value;
+		}
+
+		unsigned int workers() const { return m_worker_count; }
+	protected:
+		struct Worker
+		{
+			ParallelProcess* owner;
+			Thread thread;
+			InputElement src[blocksize];
+			OutputElement dest[blocksize];
+		};
+
+		InputQueueClass *input;
+		OutputQueueClass *output;
+		unsigned int m_worker_count;
+		Worker* m_workers;
+		Mutex m_input_mutex;	/* Serializes reading and numbering blocks */
+		Mutex m_order_mutex;	/* Protects the fields below */
+		Condition m_order;
+		unsigned int m_next_ticket;
+		unsigned int m_next_output;
+		bool m_terminating;
+		std::vector<ThreadAttributes> m_thread_attributes;
+
+		void start()
+		{
+			m_terminating = false;
+			m_next_output = m_next_ticket; /* Skip blocks lost in terminate */
+			for (unsigned int i = 0; i < m_worker_count; ++i)
+			{
+				int result;
+				if (m_thread_attributes.empty())
+					result = m_workers[i].thread.start(&run, &m_workers[i]);
+				else
+					result = m_workers[i].thread.start(&run, &m_workers[i],
+						m_thread_attributes[i % m_thread_attributes.size()]);
+				if (result != 0)
+				{
+					/* Leave no workers behind, as if terminated */
+					stop(i);
+					input = NULL;
+					output = NULL;
+					throw std::runtime_error("Failed to create thread");
+				}
+			}
+		}
+
+		/* Interrupts the queues and joins the first "started" workers */
+		void stop(unsigned int started)
+		{
+			input->interrupt_read();
+			output->interrupt_write();
+			m_order_mutex.lock();
+			m_terminating = true;
+			m_order.broadcast();
+			m_order_mutex.unlock();
+			for (unsigned int i = 0; i < started; ++i)
+				m_workers[i].thread.join();
+		}
+
+		static void* run(void* arg)
+		{
+			Worker* worker = (Worker*)arg;
+			RealtimeMemory::prepare_thread();
+			try
+			{
+				worker->owner->process(*worker);
+			}
+			catch (const dyplo::InterruptedException&)
+			{
+				// no action
+			}
+			return 0;
+		}
+
+		void process(Worker& worker)
+		{
+			for (;;)
+			{
+				unsigned int ticket;
+				{
+					ScopedLock<Mutex> lock(m_input_mutex);
+					InputElement *src;
+#ifdef _DEBUG
+					unsigned int count =
+#endif
+						input->begin_read(src, blocksize);
+					DEBUG_ASSERT(count >= blocksize, "invalid value from begin_read");
+					std::copy(src, src + blocksize, worker.src);
+					input->end_read(blocksize);
+					ticket = m_next_ticket++;
+				}
+				ProcessBlockFunction(worker.dest, worker.src);
+				{
+					ScopedLock<Mutex> lock(m_order_mutex);
+					while ((ticket != m_next_output) && !m_terminating)
+						m_order.wait(m_order_mutex);
+					if (m_terminating)
+						throw InterruptedException();
+				}
+				/* Only this worker writes until m_next_output changes */
+				OutputElement *dest;
+#ifdef _DEBUG
+				unsigned int count =
+#endif
+					output->begin_write(dest, blocksize);
+				DEBUG_ASSERT(count >= blocksize, "invalid value from begin_write");
+				std::copy(worker.dest, worker.dest + blocksize, dest);
+				output->end_write(blocksize);
+				{
+					ScopedLock<Mutex> lock(m_order_mutex);
+					++m_next_output;
+					m_order.broadcast();
+				}
+			}
+		}
+	};
 }